@@ -0,0 +1,159 @@
+// File: checksum_bench.c
+// Name: Seth Butler
+// Project: 2
+// Class: Internet Protocols
+//
+// Checks every version of calcChecksum and copyChecksum against the original 16-bit loop, then
+// times each one on datagram sized buffers, next to a memcpy followed by a separate checksum.
+// usage: checksum_bench [iterations]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <arpa/inet.h>
+
+#include "checksum.h"
+
+#define MAX_LEN 65536
+#define CHECK_LEN 2048
+
+static const char *impls[] = { "scalar", "sse2", "avx2" };
+static const unsigned sizes[] = { 64, 512, 1032, 1480, 9000, 65507 };
+
+/**
+ * refChecksum - the checksum as client.c and server.c first computed it, one word at a time
+ * @buf: The buffer being summed
+ * @nbytes: The number of bytes in the buffer
+ * @sum: The partial checksum the buffer is added to
+ *
+ * Return: uint16_t - The checksum calculated
+ **/
+static uint16_t refChecksum(const unsigned char *buf, unsigned nbytes, uint32_t sum)
+{
+  unsigned i;
+
+  for (i = 0; i < (nbytes & ~1U); i += 2) {
+    sum += (uint16_t)((buf[i] << 8) | buf[i + 1]);
+    if (sum > 0xFFFF)
+      sum -= 0xFFFF;
+  }
+  if (i < nbytes) {
+    sum += buf[i] << 8;
+    if (sum > 0xFFFF)
+      sum -= 0xFFFF;
+  }
+  return (sum);
+}
+
+/**
+ * nowNsec - the current time of the monotonic clock
+ *
+ * Return: double - nanoseconds
+ **/
+static double nowNsec(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/**
+ * verify - compares a version against refChecksum at every length and alignment up to
+ * CHECK_LEN, with random, all zero and all 0xFF data
+ * @buf: A buffer of at least CHECK_LEN + 8 bytes
+ * @dst: A buffer of at least CHECK_LEN + 8 bytes copyChecksum copies to
+ *
+ * Return: int - the number of mismatches
+ **/
+static int verify(unsigned char *buf, unsigned char *dst)
+{
+  int bad = 0;
+  uint32_t sum;
+
+  for(int fill = 0; fill < 3; fill++) {
+    for(unsigned i = 0; i < CHECK_LEN + 8; i++) buf[i] = fill == 0 ? rand() : (fill == 1 ? 0 : 0xFF);
+    for(unsigned off = 0; off < 8; off++) {
+      for(unsigned len = 0; len <= CHECK_LEN; len++) {
+        sum = (len % 3 == 0) ? 0 : (len % 3 == 1 ? 0xFFFF : (unsigned) rand() & 0xFFFF);
+        if(calcChecksum(buf + off, len, sum) != refChecksum(buf + off, len, sum)) {
+          if(bad++ < 5) printf("  mismatch: offset %u, length %u, sum %u\n", off, len, sum);
+        }
+        if(copyChecksum(dst + (7 - off), buf + off, len, sum) != refChecksum(buf + off, len, sum) ||
+            memcmp(dst + (7 - off), buf + off, len) != 0) {
+          if(bad++ < 5) printf("  copy mismatch: offset %u, length %u, sum %u\n", off, len, sum);
+        }
+      }
+    }
+  }
+  return bad;
+}
+
+int main(int argc, char *argv[])
+{
+  long iters = argc > 1 ? atol(argv[1]) : 0;
+  unsigned char *buf = malloc(MAX_LEN + 8), *dst = malloc(MAX_LEN + 8);
+  volatile uint16_t sink = 0;
+  double start, nsec;
+  long n;
+  int failed = 0;
+
+  if(buf == NULL || dst == NULL) return 1;
+  srand(1);
+  for(unsigned i = 0; i < MAX_LEN + 8; i++) buf[i] = rand();
+
+  printf("default version: %s\n", checksumImplName());
+  printf("%-14s %8s %12s %10s\n", "version", "bytes", "ns/call", "GB/s");
+
+  for(unsigned i = 0; i < sizeof(impls) / sizeof(impls[0]); i++) {
+    if(!checksumUseImpl(impls[i])) {
+      printf("%-14s not supported by this CPU\n", impls[i]);
+      continue;
+    }
+    if(verify(buf, dst)) {
+      printf("%-14s does not match the reference checksum\n", impls[i]);
+      failed = 1;
+      continue;
+    }
+
+    for(unsigned s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+      // About 256MB summed per size unless the iterations are given
+      n = iters > 0 ? iters : (256L << 20) / sizes[s];
+      start = nowNsec();
+      for(long k = 0; k < n; k++) sink += calcChecksum(buf + (k & 7), sizes[s], sink);
+      nsec = (nowNsec() - start) / n;
+      printf("%-14s %8u %12.1f %10.2f\n", impls[i], sizes[s], nsec, sizes[s] / nsec);
+    }
+
+    for(unsigned s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+      n = iters > 0 ? iters : (256L << 20) / sizes[s];
+      start = nowNsec();
+      for(long k = 0; k < n; k++) sink += copyChecksum(dst, buf + (k & 7), sizes[s], sink);
+      nsec = (nowNsec() - start) / n;
+      printf("%-7s %-6s %8u %12.1f %10.2f\n", impls[i], "copy", sizes[s], nsec, sizes[s] / nsec);
+
+      start = nowNsec();
+      for(long k = 0; k < n; k++) {
+        memcpy(dst, buf + (k & 7), sizes[s]);
+        sink += calcChecksum(dst, sizes[s], sink);
+      }
+      nsec = (nowNsec() - start) / n;
+      printf("%-7s %-6s %8u %12.1f %10.2f\n", impls[i], "2-pass", sizes[s], nsec, sizes[s] / nsec);
+    }
+  }
+
+  // The original loop, for comparison
+  for(unsigned s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+    n = iters > 0 ? iters : (256L << 20) / sizes[s];
+    start = nowNsec();
+    for(long k = 0; k < n; k++) sink += refChecksum(buf + (k & 7), sizes[s], sink);
+    nsec = (nowNsec() - start) / n;
+    printf("%-14s %8u %12.1f %10.2f\n", "original", sizes[s], nsec, sizes[s] / nsec);
+  }
+
+  free(buf);
+  free(dst);
+  return failed;
+}
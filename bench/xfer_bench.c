@@ -0,0 +1,545 @@
+// File: xfer_bench.c
+// Name: Seth Butler
+// Project: 2
+// Class: Internet Protocols
+//
+// Runs the client and server over loopback for every combination of window, MSS, loss and file
+// size, several times each, and prints one CSV line or JSON object per combination: goodput,
+// retransmissions per datagram of the file, CPU time per MB of each side and completion time
+// percentiles. Run i of every combination seeds the server's loss with seed + i and the file
+// with the seed, so two builds draw their losses from the same random numbers. Which datagrams
+// those numbers lose still depends on the order they arrive in, which timing changes, so runs
+// are compared by their percentiles rather than one by one. A run without loss that resends
+// anything is a bug, it is reported and the harness exits with 1.
+// usage: xfer_bench [-b bin-dir] [-c client-opts] [-x server-opts] [-f csv|json] [-n runs]
+//                   [-S seed] [-t timeout-sec] [-w windows] [-m msses] [-l losses] [-s sizes]
+
+#define _GNU_SOURCE   // wait4
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#define MAX_LIST 32            // The most values of each swept setting
+#define MAX_RUNS 1000          // The most runs of each combination
+#define MAX_ARGS 64            // The most arguments passed to the client or server
+#define READY_MSEC 2000        // How long the server has to bind its port
+#define SERVER_GRACE_SEC 5     // How long the server has to exit after the client does
+#define LINE_SIZE 512
+
+/**
+ * runResult - what one transfer measured
+ * @ok: 1 if both exited with 0 and the copy matches the file
+ * @seconds: From starting the client until it exited
+ * @resent: Datagrams the client resent, after a timeout or a fast retransmit, from its streams' counters
+ * @clientCpu: Seconds of user and system time the client used
+ * @serverCpu: Seconds of user and system time the server used
+ **/
+struct runResult {
+  int ok;
+  double seconds;
+  unsigned long resent;
+  double clientCpu;
+  double serverCpu;
+};
+
+/**
+ * summary - what the runs of one combination that delivered the file measured
+ * @goodput: Megabits of the file per second, at the median completion time
+ * @resent: Datagrams resent per datagram of the file, the mean
+ * @clientCpu: Milliseconds of CPU time the client used per MB of the file, the mean
+ * @serverCpu: Milliseconds of CPU time the server used per MB of the file, the mean
+ * @p50, @p90, @p99, @max: Completion time percentiles, in seconds
+ **/
+struct summary {
+  double goodput, resent, clientCpu, serverCpu;
+  double p50, p90, p99, max;
+};
+
+static const char *binDir = ".";
+static char *clientOpts = "", *serverOpts = "";
+static char tmpDir[] = "/tmp/xfer_benchXXXXXX";
+static volatile pid_t timedPid = 0;   // Killed when the alarm goes off
+
+/**
+ * nowSec - the current time of the monotonic clock
+ *
+ * Return: double - seconds
+ **/
+static double nowSec(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**
+ * cpuSec - the user and system time in a resource usage
+ * @ru: The usage
+ *
+ * Return: double - seconds
+ **/
+static double cpuSec(const struct rusage *ru)
+{
+  return ru->ru_utime.tv_sec + ru->ru_utime.tv_usec / 1e6 + ru->ru_stime.tv_sec + ru->ru_stime.tv_usec / 1e6;
+}
+
+/**
+ * onAlarm - kills the process being waited for once it has taken too long
+ * @sig: The signal
+ **/
+static void onAlarm(int sig)
+{
+  (void) sig;
+  if(timedPid > 0) kill(timedPid, SIGKILL);
+}
+
+/**
+ * parseList - splits a comma separated list of numbers, each with an optional K or M suffix
+ * @str: The list
+ * @vals: Filled with the numbers
+ *
+ * Return: int - how many there are, 0 if one doesn't parse
+ **/
+static int parseList(const char *str, double *vals)
+{
+  char *end;
+  int n = 0;
+
+  while(*str && n < MAX_LIST) {
+    vals[n] = strtod(str, &end);
+    if(end == str || vals[n] < 0) return 0;
+    if(*end == 'K' || *end == 'k') vals[n] *= 1024, end++;
+    else if(*end == 'M' || *end == 'm') vals[n] *= 1024 * 1024, end++;
+    n++;
+    if(*end == ',') end++;
+    else if(*end != '\0') return 0;
+    str = end;
+  }
+  return n;
+}
+
+/**
+ * splitArgs - appends the words of a string of options to an argument list
+ * @args: The argument list
+ * @n: The number of arguments in it
+ * @opts: The options, separated by spaces, which are cut apart in place
+ *
+ * Return: int - the new number of arguments
+ **/
+static int splitArgs(char **args, int n, char *opts)
+{
+  for(char *word = strtok(opts, " "); word != NULL && n < MAX_ARGS - 8; word = strtok(NULL, " ")) args[n++] = word;
+  return n;
+}
+
+/**
+ * spawn - starts a program with its output going to a file
+ * @args: The program and its arguments
+ * @logPath: Where its stdout and stderr go
+ *
+ * Return: pid_t - the process
+ **/
+static pid_t spawn(char **args, const char *logPath)
+{
+  pid_t pid = fork();
+  int fd;
+
+  if(pid < 0) {
+    perror("fork");
+    exit(1);
+  }
+  if(pid == 0) {
+    fd = open(logPath, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if(fd >= 0) {
+      dup2(fd, STDOUT_FILENO);
+      dup2(fd, STDERR_FILENO);
+      close(fd);
+    }
+    execv(args[0], args);
+    perror(args[0]);
+    _exit(127);
+  }
+  return pid;
+}
+
+/**
+ * waitFor - waits for a process, killing it if it doesn't exit in time
+ * @pid: The process
+ * @seconds: How long it has
+ * @ru: Filled with its resource usage
+ *
+ * Return: int - 1 if it exited with 0, 0 otherwise
+ **/
+static int waitFor(pid_t pid, unsigned seconds, struct rusage *ru)
+{
+  int status;
+
+  timedPid = pid;
+  alarm(seconds);
+  while(wait4(pid, &status, 0, ru) < 0)
+    if(errno != EINTR) return 0;
+  alarm(0);
+  timedPid = 0;
+  return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+/**
+ * freePort - finds a UDP port on loopback nothing is bound to
+ *
+ * Return: int - the port
+ **/
+static int freePort(void)
+{
+  struct sockaddr_in addr = { .sin_family = AF_INET, .sin_addr.s_addr = htonl(INADDR_LOOPBACK) };
+  socklen_t len = sizeof(addr);
+  int fd = socket(AF_INET, SOCK_DGRAM, 0);
+
+  if(fd < 0 || bind(fd, (struct sockaddr*) &addr, len) < 0 || getsockname(fd, (struct sockaddr*) &addr, &len) < 0) {
+    perror("Finding a free port");
+    exit(1);
+  }
+  close(fd);
+  return ntohs(addr.sin_port);
+}
+
+/**
+ * waitBound - waits until the server has bound its port, so the client's first SYN isn't lost.
+ * The port is looked for in /proc/net/udp, binding it to find out could beat the server to it.
+ * @port: The port
+ *
+ * Return: int - 1 once it's bound, 0 if it wasn't in time
+ **/
+static int waitBound(int port)
+{
+  char line[LINE_SIZE], local[16];
+  unsigned localPort;
+  int bound = 0;
+  FILE *f;
+
+  for(int ms = 0; ms < READY_MSEC && !bound; ms++) {
+    f = fopen("/proc/net/udp", "r");
+    if(f == NULL) return 0;
+    while(!bound && fgets(line, sizeof(line), f) != NULL)
+      bound = sscanf(line, " %*d: %15[0-9A-Fa-f]:%x", local, &localPort) == 2 && localPort == (unsigned) port;
+    fclose(f);
+    if(!bound) usleep(1000);
+  }
+  return bound;
+}
+
+/**
+ * makeFile - writes a file of seeded random bytes
+ * @path: Where it's written
+ * @size: Its size in bytes
+ * @seed: The seed of its bytes
+ **/
+static void makeFile(const char *path, size_t size, uint64_t seed)
+{
+  unsigned char buf[65536];
+  uint64_t x = seed * 0x9e3779b97f4a7c15ULL + 1;
+  FILE *f = fopen(path, "wb");
+
+  if(f == NULL) {
+    perror(path);
+    exit(1);
+  }
+  while(size > 0) {
+    size_t n = size < sizeof(buf) ? size : sizeof(buf);
+
+    for(size_t i = 0; i < n; i += 8) {
+      x ^= x >> 12; x ^= x << 25; x ^= x >> 27;
+      uint64_t r = x * 0x2545f4914f6cdd1dULL;
+      memcpy(buf + i, &r, n - i < 8 ? n - i : 8);
+    }
+    fwrite(buf, 1, n, f);
+    size -= n;
+  }
+  fclose(f);
+}
+
+/**
+ * sameFile - compares two files
+ * @a: One file
+ * @b: The other
+ *
+ * Return: int - 1 if they have the same bytes, 0 otherwise
+ **/
+static int sameFile(const char *a, const char *b)
+{
+  unsigned char bufA[65536], bufB[65536];
+  FILE *fa = fopen(a, "rb"), *fb = fopen(b, "rb");
+  size_t na, nb;
+  int same = fa != NULL && fb != NULL;
+
+  while(same) {
+    na = fread(bufA, 1, sizeof(bufA), fa);
+    nb = fread(bufB, 1, sizeof(bufB), fb);
+    if(na != nb || memcmp(bufA, bufB, na) != 0) same = 0;
+    if(na == 0) break;
+  }
+  if(fa) fclose(fa);
+  if(fb) fclose(fb);
+  return same;
+}
+
+/**
+ * countResent - adds up the datagrams each stream of a client says it resent when it closes
+ * @logPath: The client's output
+ *
+ * Return: unsigned long - the datagrams resent
+ **/
+static unsigned long countResent(const char *logPath)
+{
+  char line[LINE_SIZE], *count;
+  unsigned long resent = 0;
+  FILE *f = fopen(logPath, "r");
+
+  if(f == NULL) return 0;
+  while(fgets(line, sizeof(line), f) != NULL) {
+    if(strncmp(line, "Client: stream ", 15) != 0 || (count = strstr(line, " datagrams resent")) == NULL) continue;
+    while(count > line && count[-1] >= '0' && count[-1] <= '9') count--;
+    resent += strtoul(count, NULL, 10);
+  }
+  fclose(f);
+  return resent;
+}
+
+/**
+ * runOnce - sends a file from a client to a server over loopback
+ * @inPath: The file
+ * @window: The client's N
+ * @mss: The client's MSS
+ * @loss: The server's loss probability
+ * @seed: The seed of the server's loss
+ * @timeout: How many seconds the client has
+ * @res: Filled with what was measured
+ **/
+static void runOnce(const char *inPath, int window, int mss, double loss, uint64_t seed, unsigned timeout,
+    struct runResult *res)
+{
+  char server[256], client[256], outPath[256], serverLog[256], clientLog[256];
+  char portStr[16], winStr[16], mssStr[16], lossStr[32], seedStr[48], optBuf[2][256];
+  char *args[MAX_ARGS];
+  struct rusage clientRu = {0}, serverRu = {0};
+  pid_t serverPid, clientPid;
+  int port = freePort(), n, clientOk, serverOk;
+  double start;
+
+  snprintf(server, sizeof(server), "%s/server", binDir);
+  snprintf(client, sizeof(client), "%s/client", binDir);
+  snprintf(outPath, sizeof(outPath), "%s/out", tmpDir);
+  snprintf(serverLog, sizeof(serverLog), "%s/server.log", tmpDir);
+  snprintf(clientLog, sizeof(clientLog), "%s/client.log", tmpDir);
+  snprintf(portStr, sizeof(portStr), "%d", port);
+  snprintf(winStr, sizeof(winStr), "%d", window);
+  snprintf(mssStr, sizeof(mssStr), "%d", mss);
+  snprintf(lossStr, sizeof(lossStr), "%g", loss);
+  snprintf(seedStr, sizeof(seedStr), "seed=%llu", (unsigned long long) seed);
+  snprintf(optBuf[0], sizeof(optBuf[0]), "%s", serverOpts);
+  snprintf(optBuf[1], sizeof(optBuf[1]), "%s", clientOpts);
+  unlink(outPath);
+
+  n = 0;
+  args[n++] = server;
+  args[n++] = "-I";
+  args[n++] = seedStr;
+  n = splitArgs(args, n, optBuf[0]);
+  args[n++] = portStr;
+  args[n++] = outPath;
+  args[n++] = lossStr;
+  args[n] = NULL;
+  serverPid = spawn(args, serverLog);
+  if(!waitBound(port)) fprintf(stderr, "xfer_bench: the server didn't bind port %d\n", port);
+
+  n = 0;
+  args[n++] = client;
+  n = splitArgs(args, n, optBuf[1]);
+  args[n++] = "localhost";
+  args[n++] = portStr;
+  args[n++] = (char*) inPath;
+  args[n++] = winStr;
+  args[n++] = mssStr;
+  args[n] = NULL;
+  start = nowSec();
+  clientPid = spawn(args, clientLog);
+  clientOk = waitFor(clientPid, timeout, &clientRu);
+  res->seconds = nowSec() - start;
+  serverOk = waitFor(serverPid, SERVER_GRACE_SEC, &serverRu);
+
+  res->ok = clientOk && serverOk && sameFile(inPath, outPath);
+  res->resent = countResent(clientLog);
+  res->clientCpu = cpuSec(&clientRu);
+  res->serverCpu = cpuSec(&serverRu);
+}
+
+/**
+ * compareDouble - orders doubles for qsort
+ * @a: One double
+ * @b: The other
+ *
+ * Return: int - less than, equal to or greater than 0 as a is
+ **/
+static int compareDouble(const void *a, const void *b)
+{
+  double x = *(const double*) a, y = *(const double*) b;
+
+  return (x > y) - (x < y);
+}
+
+/**
+ * percentile - the nearest rank percentile of sorted values
+ * @sorted: The values, in order
+ * @n: How many there are
+ * @pct: The percentile, 0 to 100
+ *
+ * Return: double - the value
+ **/
+static double percentile(const double *sorted, int n, double pct)
+{
+  int rank = (int) (pct / 100 * n + 0.999999);
+
+  if(n == 0) return 0;
+  if(rank < 1) rank = 1;
+  return sorted[rank > n ? n - 1 : rank - 1];
+}
+
+int main(int argc, char *argv[])
+{
+  double windows[MAX_LIST], msses[MAX_LIST], losses[MAX_LIST], sizes[MAX_LIST];
+  int numWindows, numMsses, numLosses, numSizes, runs = 5, json = 0, first = 1, opt, cleanResends = 0;
+  unsigned timeout = 60;
+  uint64_t seed = 1;
+  const char *windowList = "16,64", *mssList = "500,1400", *lossList = "0,0.01", *sizeList = "1M";
+  char inPath[256];
+  struct runResult results[MAX_RUNS];
+  double times[MAX_RUNS];
+  struct sigaction sa;
+
+  while((opt = getopt(argc, argv, "b:c:f:l:m:n:s:S:t:w:x:")) != -1) {
+    switch(opt) {
+      case 'b': binDir = optarg; break;
+      case 'c': clientOpts = optarg; break;
+      case 'f': json = strcmp(optarg, "json") == 0; break;
+      case 'l': lossList = optarg; break;
+      case 'm': mssList = optarg; break;
+      case 'n': runs = atoi(optarg); break;
+      case 's': sizeList = optarg; break;
+      case 'S': seed = strtoull(optarg, NULL, 10); break;
+      case 't': timeout = atoi(optarg); break;
+      case 'w': windowList = optarg; break;
+      case 'x': serverOpts = optarg; break;
+      default: runs = 0;
+    }
+  }
+  numWindows = parseList(windowList, windows);
+  numMsses = parseList(mssList, msses);
+  numLosses = parseList(lossList, losses);
+  numSizes = parseList(sizeList, sizes);
+
+  if(runs < 1 || runs > MAX_RUNS || timeout == 0 || !numWindows || !numMsses || !numLosses || !numSizes) {
+    fprintf(stderr, "usage: %s [-b bin-dir] [-c client-opts] [-x server-opts] [-f csv|json] [-n runs] [-S seed]\n"
+        "    [-t timeout-sec] [-w windows] [-m msses] [-l losses] [-s sizes]\n", argv[0]);
+    fprintf(stderr, "  -w, -m, -l, -s: comma separated values swept, sizes may end in K or M"
+        " (default %s; %s; %s; %s)\n", windowList, mssList, lossList, sizeList);
+    fprintf(stderr, "  -n: runs of each combination, run i seeds the server's loss with seed + i (1-%d, default 5)."
+        " Timing still changes which datagrams are lost, so compare percentiles, not single runs\n",
+        MAX_RUNS);
+    fprintf(stderr, "  -b: where client and server are (default .), -c, -x: options passed to them\n");
+    exit(1);
+  }
+
+  if(mkdtemp(tmpDir) == NULL) {
+    perror("mkdtemp");
+    exit(1);
+  }
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_handler = onAlarm;
+  sigaction(SIGALRM, &sa, NULL);    // Without SA_RESTART, so wait4 returns to be retried
+  snprintf(inPath, sizeof(inPath), "%s/in", tmpDir);
+  fprintf(stderr, "xfer_bench: the client's and server's output of the last run is kept in %s\n", tmpDir);
+
+  if(json) printf("[");
+  else printf("window,mss,loss,bytes,runs,ok,goodput_mbps_p50,resent_per_dgram,client_cpu_ms_per_mb,"
+      "server_cpu_ms_per_mb,time_p50,time_p90,time_p99,time_max\n");
+
+  for(int s = 0; s < numSizes; s++) {
+    size_t size = sizes[s];
+
+    makeFile(inPath, size, seed);
+    for(int w = 0; w < numWindows; w++)
+    for(int m = 0; m < numMsses; m++)
+    for(int l = 0; l < numLosses; l++) {
+      struct summary sum;
+      double dgrams = size > msses[m] ? (size + msses[m] - 1) / (size_t) msses[m] : 1;
+      double mb = size > 0 ? size / 1e6 : 1e-6;
+      int ok = 0, resending = 0;
+
+      // Only the runs that delivered the file are measured, the others are counted as failed
+      memset(&sum, 0, sizeof(sum));
+      for(int r = 0; r < runs; r++) {
+        // On a terminal each run's line replaces the last, in a file each has its own
+        fprintf(stderr, "window %g, mss %g, loss %g, %zu bytes: run %d of %d%s", windows[w], msses[m], losses[l], size,
+            r + 1, runs, isatty(STDERR_FILENO) ? "\r" : "\n");
+        runOnce(inPath, windows[w], msses[m], losses[l], seed + r, timeout, &results[r]);
+        if(losses[l] == 0 && results[r].resent > 0) resending++;
+        if(!results[r].ok) continue;
+        times[ok++] = results[r].seconds;
+        sum.resent += results[r].resent / dgrams;
+        sum.clientCpu += results[r].clientCpu * 1000 / mb;
+        sum.serverCpu += results[r].serverCpu * 1000 / mb;
+      }
+      if(isatty(STDERR_FILENO)) fprintf(stderr, "\n");
+      if(resending > 0) {
+        fprintf(stderr, "xfer_bench: WARNING: %d of %d runs resent datagrams with no loss, datagrams are being dropped"
+            " on loopback\n", resending, runs);
+        cleanResends += resending;
+      }
+
+      if(ok > 0) {
+        qsort(times, ok, sizeof(times[0]), compareDouble);
+        sum.resent /= ok;
+        sum.clientCpu /= ok;
+        sum.serverCpu /= ok;
+        sum.p50 = percentile(times, ok, 50);
+        sum.p90 = percentile(times, ok, 90);
+        sum.p99 = percentile(times, ok, 99);
+        sum.max = times[ok - 1];
+        sum.goodput = size * 8 / 1e6 / sum.p50;
+      }
+      if(json)
+        printf("%s\n  {\"window\": %g, \"mss\": %g, \"loss\": %g, \"bytes\": %zu, \"runs\": %d, \"ok\": %d, "
+            "\"goodput_mbps_p50\": %.3f, \"resent_per_dgram\": %.4f, \"client_cpu_ms_per_mb\": %.3f, "
+            "\"server_cpu_ms_per_mb\": %.3f, \"time_p50\": %.4f, \"time_p90\": %.4f, \"time_p99\": %.4f, "
+            "\"time_max\": %.4f}", first ? "" : ",", windows[w], msses[m], losses[l], size, runs, ok, sum.goodput,
+            sum.resent, sum.clientCpu, sum.serverCpu, sum.p50, sum.p90, sum.p99, sum.max);
+      else
+        printf("%g,%g,%g,%zu,%d,%d,%.3f,%.4f,%.3f,%.3f,%.4f,%.4f,%.4f,%.4f\n", windows[w], msses[m], losses[l], size,
+            runs, ok, sum.goodput, sum.resent, sum.clientCpu, sum.serverCpu, sum.p50, sum.p90, sum.p99, sum.max);
+      fflush(stdout);
+      first = 0;
+    }
+  }
+  if(json) printf("\n]\n");
+
+  // Only the logs are left behind
+  unlink(inPath);
+  snprintf(inPath, sizeof(inPath), "%s/out", tmpDir);
+  unlink(inPath);
+  return cleanResends > 0;
+}
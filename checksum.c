@@ -0,0 +1,296 @@
+// File: checksum.c
+// Name: Seth Butler
+// Project: 2
+// Class: Internet Protocols
+
+#include <string.h>
+#include <arpa/inet.h>
+
+#include "checksum.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define CHECKSUM_X86
+#endif
+
+/*
+ * The one's complement sum doesn't depend on byte order (RFC 1071): the words are summed as
+ * they sit in memory and the result is put in network byte order at the end. Since 2^16, 2^32
+ * and 2^64 are all 1 mod 0xFFFF, the sum of a buffer's 64-bit or 32-bit words folds to the
+ * same 16 bits as the sum of its 16-bit words.
+ */
+
+typedef uint64_t (*sumFunc)(const unsigned char *buf, size_t nbytes, uint64_t acc);
+typedef uint64_t (*copyFunc)(unsigned char *dst, const unsigned char *src, size_t nbytes, uint64_t acc);
+
+/**
+ * addCarry - adds two 64-bit partial sums, wrapping the carry around
+ * @acc: The running sum
+ * @value: The value being added
+ *
+ * Return: uint64_t - the new running sum
+ **/
+static inline uint64_t addCarry(uint64_t acc, uint64_t value)
+{
+  acc += value;
+  return acc + (acc < value);
+}
+
+/**
+ * fold - folds a 64-bit partial sum to 16 bits
+ * @acc: The partial sum
+ *
+ * Return: uint16_t - the folded sum, 0 only if the partial sum was 0
+ **/
+static inline uint16_t fold(uint64_t acc)
+{
+  while(acc >> 16) acc = (acc & 0xFFFF) + (acc >> 16);
+  return acc;
+}
+
+/**
+ * sumScalar - sums a buffer 8 bytes at a time
+ * @buf: The buffer being summed
+ * @nbytes: The number of bytes in the buffer
+ * @acc: The partial sum the buffer is added to
+ *
+ * Return: uint64_t - the partial sum
+ **/
+static uint64_t sumScalar(const unsigned char *buf, size_t nbytes, uint64_t acc)
+{
+  uint64_t word64;
+  uint32_t word32;
+  uint16_t word16;
+  unsigned char last[2] = {0};
+
+  for(; nbytes >= 8; buf += 8, nbytes -= 8) {
+    memcpy(&word64, buf, 8);
+    acc = addCarry(acc, word64);
+  }
+  if(nbytes >= 4) {
+    memcpy(&word32, buf, 4);
+    acc = addCarry(acc, word32);
+    buf += 4; nbytes -= 4;
+  }
+  if(nbytes >= 2) {
+    memcpy(&word16, buf, 2);
+    acc = addCarry(acc, word16);
+    buf += 2; nbytes -= 2;
+  }
+  // An odd last byte is the high byte of a word padded with zero
+  if(nbytes) {
+    last[0] = *buf;
+    memcpy(&word16, last, 2);
+    acc = addCarry(acc, word16);
+  }
+  return acc;
+}
+
+/**
+ * copyScalar - copies a buffer 8 bytes at a time, summing each word on its way through
+ * @dst: Where the bytes are copied to
+ * @src: The buffer being copied and summed
+ * @nbytes: The number of bytes in the buffer
+ * @acc: The partial sum the buffer is added to
+ *
+ * Return: uint64_t - the partial sum
+ **/
+static uint64_t copyScalar(unsigned char *dst, const unsigned char *src, size_t nbytes, uint64_t acc)
+{
+  uint64_t word64;
+
+  for(; nbytes >= 8; src += 8, dst += 8, nbytes -= 8) {
+    memcpy(&word64, src, 8);
+    memcpy(dst, &word64, 8);
+    acc = addCarry(acc, word64);
+  }
+  memcpy(dst, src, nbytes);
+  return sumScalar(dst, nbytes, acc);
+}
+
+#ifdef CHECKSUM_X86
+/**
+ * sumSse2 - sums a buffer 16 bytes at a time, widening each 32-bit word into a 64-bit lane
+ * so no carry is lost. The bytes after the last full vector are summed by sumScalar()
+ * @buf: The buffer being summed
+ * @nbytes: The number of bytes in the buffer
+ * @acc: The partial sum the buffer is added to
+ *
+ * Return: uint64_t - the partial sum
+ **/
+__attribute__((target("sse2")))
+static uint64_t sumSse2(const unsigned char *buf, size_t nbytes, uint64_t acc)
+{
+  __m128i zero = _mm_setzero_si128(), lo = zero, hi = zero, v;
+  uint64_t lanes[2];
+
+  for(; nbytes >= 16; buf += 16, nbytes -= 16) {
+    v = _mm_loadu_si128((const __m128i*) buf);
+    lo = _mm_add_epi64(lo, _mm_unpacklo_epi32(v, zero));
+    hi = _mm_add_epi64(hi, _mm_unpackhi_epi32(v, zero));
+  }
+  _mm_storeu_si128((__m128i*) lanes, _mm_add_epi64(lo, hi));
+  acc = addCarry(acc, lanes[0]);
+  acc = addCarry(acc, lanes[1]);
+  return sumScalar(buf, nbytes, acc);
+}
+
+/**
+ * copySse2 - copies a buffer 16 bytes at a time, like sumSse2() storing each vector it loads
+ * @dst: Where the bytes are copied to
+ * @src: The buffer being copied and summed
+ * @nbytes: The number of bytes in the buffer
+ * @acc: The partial sum the buffer is added to
+ *
+ * Return: uint64_t - the partial sum
+ **/
+__attribute__((target("sse2")))
+static uint64_t copySse2(unsigned char *dst, const unsigned char *src, size_t nbytes, uint64_t acc)
+{
+  __m128i zero = _mm_setzero_si128(), lo = zero, hi = zero, v;
+  uint64_t lanes[2];
+
+  for(; nbytes >= 16; src += 16, dst += 16, nbytes -= 16) {
+    v = _mm_loadu_si128((const __m128i*) src);
+    _mm_storeu_si128((__m128i*) dst, v);
+    lo = _mm_add_epi64(lo, _mm_unpacklo_epi32(v, zero));
+    hi = _mm_add_epi64(hi, _mm_unpackhi_epi32(v, zero));
+  }
+  _mm_storeu_si128((__m128i*) lanes, _mm_add_epi64(lo, hi));
+  acc = addCarry(acc, lanes[0]);
+  acc = addCarry(acc, lanes[1]);
+  return copyScalar(dst, src, nbytes, acc);
+}
+
+/**
+ * sumAvx2 - sums a buffer 32 bytes at a time, like sumSse2() with twice the lanes
+ * @buf: The buffer being summed
+ * @nbytes: The number of bytes in the buffer
+ * @acc: The partial sum the buffer is added to
+ *
+ * Return: uint64_t - the partial sum
+ **/
+__attribute__((target("avx2")))
+static uint64_t sumAvx2(const unsigned char *buf, size_t nbytes, uint64_t acc)
+{
+  __m256i zero = _mm256_setzero_si256(), lo = zero, hi = zero, v;
+  uint64_t lanes[4];
+
+  for(; nbytes >= 32; buf += 32, nbytes -= 32) {
+    v = _mm256_loadu_si256((const __m256i*) buf);
+    lo = _mm256_add_epi64(lo, _mm256_unpacklo_epi32(v, zero));
+    hi = _mm256_add_epi64(hi, _mm256_unpackhi_epi32(v, zero));
+  }
+  _mm256_storeu_si256((__m256i*) lanes, _mm256_add_epi64(lo, hi));
+  for(int i = 0; i < 4; i++) acc = addCarry(acc, lanes[i]);
+  return sumScalar(buf, nbytes, acc);
+}
+
+/**
+ * copyAvx2 - copies a buffer 32 bytes at a time, like sumAvx2() storing each vector it loads
+ * @dst: Where the bytes are copied to
+ * @src: The buffer being copied and summed
+ * @nbytes: The number of bytes in the buffer
+ * @acc: The partial sum the buffer is added to
+ *
+ * Return: uint64_t - the partial sum
+ **/
+__attribute__((target("avx2")))
+static uint64_t copyAvx2(unsigned char *dst, const unsigned char *src, size_t nbytes, uint64_t acc)
+{
+  __m256i zero = _mm256_setzero_si256(), lo = zero, hi = zero, v;
+  uint64_t lanes[4];
+
+  for(; nbytes >= 32; src += 32, dst += 32, nbytes -= 32) {
+    v = _mm256_loadu_si256((const __m256i*) src);
+    _mm256_storeu_si256((__m256i*) dst, v);
+    lo = _mm256_add_epi64(lo, _mm256_unpacklo_epi32(v, zero));
+    hi = _mm256_add_epi64(hi, _mm256_unpackhi_epi32(v, zero));
+  }
+  _mm256_storeu_si256((__m256i*) lanes, _mm256_add_epi64(lo, hi));
+  for(int i = 0; i < 4; i++) acc = addCarry(acc, lanes[i]);
+  return copyScalar(dst, src, nbytes, acc);
+}
+#endif
+
+static const struct {
+  const char *name;
+  sumFunc sum;
+  copyFunc copy;
+  const char *cpuFeature;   // NULL if every CPU supports it
+} sumImpls[] = {
+#ifdef CHECKSUM_X86
+  { "avx2", sumAvx2, copyAvx2, "avx2" },
+  { "sse2", sumSse2, copySse2, "sse2" },
+#endif
+  { "scalar", sumScalar, copyScalar, NULL },
+};
+
+#define NUM_SUM_IMPLS (sizeof(sumImpls) / sizeof(sumImpls[0]))
+
+static int sumImpl;         // The index into sumImpls, set by pickImpl before main
+
+/**
+ * implSupported - if the CPU supports a version of the summing loop
+ * @impl: The index into sumImpls
+ *
+ * Return: int - 1 if supported, 0 otherwise
+ **/
+static int implSupported(int impl)
+{
+  if(sumImpls[impl].cpuFeature == NULL) return 1;
+#ifdef CHECKSUM_X86
+  __builtin_cpu_init();
+  if(strcmp(sumImpls[impl].cpuFeature, "avx2") == 0) return __builtin_cpu_supports("avx2");
+  if(strcmp(sumImpls[impl].cpuFeature, "sse2") == 0) return __builtin_cpu_supports("sse2");
+#endif
+  return 0;
+}
+
+/**
+ * pickImpl - picks the first, and fastest, version of the summing loop the CPU supports. It runs
+ * before main, so before any thread can checksum, and sumImpl is only read after it.
+ **/
+__attribute__((constructor)) static void pickImpl(void)
+{
+  int impl = 0;
+
+  while(!implSupported(impl)) impl++;
+  sumImpl = impl;
+}
+
+int checksumUseImpl(const char *name)
+{
+  for(unsigned i = 0; i < NUM_SUM_IMPLS; i++) {
+    if(strcmp(sumImpls[i].name, name) != 0) continue;
+    if(!implSupported(i)) return 0;
+    sumImpl = i;
+    return 1;
+  }
+  return 0;
+}
+
+const char *checksumImplName(void)
+{
+  return sumImpls[sumImpl].name;
+}
+
+uint16_t calcChecksum(const unsigned char *buf, unsigned nbytes, uint32_t sum)
+{
+  // The partial checksum is in host byte order, the words are summed in memory order
+  return ntohs(fold(sumImpls[sumImpl].sum(buf, nbytes, htons(sum))));
+}
+
+uint16_t copyChecksum(unsigned char *dst, const unsigned char *src, unsigned nbytes, uint32_t sum)
+{
+  return ntohs(fold(sumImpls[sumImpl].copy(dst, src, nbytes, htons(sum))));
+}
+
+uint64_t fnv1a64(uint64_t hash, const unsigned char *buf, size_t nbytes)
+{
+  for(size_t i = 0; i < nbytes; i++) {
+    hash ^= buf[i];
+    hash *= FNV64_PRIME;
+  }
+  return hash;
+}
@@ -0,0 +1,70 @@
+// File: checksum.h
+// Name: Seth Butler
+// Project: 2
+// Class: Internet Protocols
+
+#ifndef CHECKSUM_H
+#define CHECKSUM_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/**
+ * calcChecksum - calculate the checksum of a datagram, the one's complement sum of its
+ * big-endian 16-bit words (not complemented)
+ * @buf: The datagram to calculate the checksum over
+ * @nbytes: The number of bytes in the buffer. An odd last byte is the high byte of a word
+ * @sum: A partial checksum (less than 0x10000) the datagram's words are added to
+ *
+ * Return: uint16_t - The checksum calculated
+ *
+ * Note: the words are summed 64 bits or a vector at a time and folded to 16 bits once at the
+ *   end. The fastest version the CPU supports is picked when the program starts.
+ **/
+uint16_t calcChecksum(const unsigned char *buf, unsigned nbytes, uint32_t sum);
+
+/**
+ * copyChecksum - copies a buffer and returns the checksum of the bytes copied, reading each
+ * byte once
+ * @dst: Where the bytes are copied to, which must not overlap src
+ * @src: The bytes being copied
+ * @nbytes: The number of bytes copied
+ * @sum: A partial checksum (less than 0x10000) the bytes are added to
+ *
+ * Return: uint16_t - calcChecksum(dst, nbytes, sum)
+ *
+ * Note: a checksum can be continued over more bytes by passing it as the partial checksum of
+ *   the next call, as long as every call but the last covers an even number of bytes.
+ **/
+uint16_t copyChecksum(unsigned char *dst, const unsigned char *src, unsigned nbytes, uint32_t sum);
+
+/**
+ * checksumUseImpl - makes calcChecksum use one version of the summing loop
+ * @name: "scalar", "sse2" or "avx2"
+ *
+ * Return: int - 1 if the version exists and the CPU supports it, 0 otherwise
+ **/
+int checksumUseImpl(const char *name);
+
+/**
+ * checksumImplName - the version of the summing loop calcChecksum uses
+ *
+ * Return: const char* - "scalar", "sse2" or "avx2"
+ **/
+const char *checksumImplName(void);
+
+#define FNV64_OFFSET 0xcbf29ce484222325ULL  // The FNV-1a 64 hash of no bytes
+#define FNV64_PRIME 0x100000001b3ULL
+
+/**
+ * fnv1a64 - continues the FNV-1a 64 hash of a file over more of its bytes, which checks that
+ * a file arrived whole end to end
+ * @hash: The hash of the bytes before buf, FNV64_OFFSET for the first
+ * @buf: The next bytes of the file
+ * @nbytes: The number of bytes
+ *
+ * Return: uint64_t - The hash of the bytes so far
+ **/
+uint64_t fnv1a64(uint64_t hash, const unsigned char *buf, size_t nbytes);
+
+#endif
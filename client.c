@@ -3,6 +3,8 @@
 // Project: 2 
 // Class: Internet Protocols 
 
+#define _GNU_SOURCE   // sendmmsg & recvmmsg
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
@@ -10,24 +12,361 @@
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
+#include <netinet/udp.h>
 #include <netdb.h> 
 #include <limits.h>
 #include <time.h>
 #include <sys/time.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <pthread.h>
+#include <math.h>
+#include <sys/random.h>
+
+#include "checksum.h"
+#include "impair.h"
 
 #undef DEBUG
 
-// Represents the max the MSS can be - (The server would require larger buffers or handle fragmentation
+// Represents the max the datagram can be for a server that doesn't agree an MSS in the handshake
 #define BUFFER_SIZE 1024
-#define TIMEOUT 3.0		// The retranmission timer's timeout
+#define TIMEOUT 1.0		// The retranmission timeout used until the first RTT has been measured
+#define MIN_RTO_MSEC 200	// Default lower bound of the retransmission timeout
+#define MAX_RTO_MSEC 60000	// Default upper bound of the retransmission timeout
+#define DUP_ACK_THRESH 3	// The number of duplicate ACKs that trigger a fast retransmit
+#define SLOT_ALIGN 64		// Send ring slots start on a cache line
+#define SEND_BATCH 64		// The most datagrams handed to one sendmmsg call
+#define ACK_BATCH 64		// The most ACKs taken from one recvmmsg call
+#define GSO_MAX_SEGS 64		// The most datagrams the kernel will cut from one segmentation offload send
+#define GSO_MAX_BYTES 65507	// The largest UDP payload, which a segmentation offload send must fit in
+#define WHEEL_SLOTS 512		// The number of buckets in the timer wheel (a power of 2)
+#define WHEEL_TICK_USEC 1000	// The number of microseconds covered by each bucket
+#define HANDSHAKE_TRIES 3	// The number of SYNs sent before falling back to Go-Back-N
+#define HANDSHAKE_TIMEOUT 1	// The number of seconds to wait for each SYN-ACK
+#define FIN_TRIES 6		// The number of closes sent before giving up on the FIN ACK
+#define FILE_BUFFER_SIZE 65536	// The number of bytes read from the file at a time
+#define DATA_HDR_LEN 8		// The header of a datagram without a connection ID
+#define CONN_HDR_LEN 12		// The data header followed by the connection ID
+#define MAX_NAME_LEN 255	// The longest name an option can carry
+#define MAX_STREAMS 64		// The most streams a file can be split into
+#define MAX_MSS (65507 - CONN_HDR_LEN)	// The largest MSS, a full UDP datagram
+#define MAX_WINDOW (1 << 20)	// The largest window N, far inside the half of the sequence space serial arithmetic tells apart
+#define IP_UDP_HDR_LEN 28	// The IPv4 and UDP headers in front of each datagram
+#define PROBE_TRIES 3		// The number of rounds of probes sent to find the largest datagram the path carries
+#define PROBE_TIMEOUT_MSEC 100	// The milliseconds to wait for the answers to each round
+#define INIT_CWND 10		// The congestion window a stream starts with (RFC 6928)
+#define MIN_CWND 2		// The lowest a loss reduces the congestion window to
+#define CUBIC_C 0.4		// CUBIC's scaling constant (RFC 8312)
+#define CUBIC_BETA 0.7		// CUBIC's multiplicative decrease factor
+#define PACING_SS_GAIN 2.0	// The pacing rate is this many windows per RTT in slow start
+#define PACING_CA_GAIN 1.2	// and this many after it
+#define PACING_BURST_USEC 1000	// The pacer saves up at most this long of sending
+#define PACING_BURST_DGRAMS 4	// but never less than this many datagrams
+
+// Handshake options, encoded as (type, length, value) in the SYN / SYN-ACK data
+#define OPT_MODE 1
+#define OPT_WINDOW 2
+#define OPT_CONNID 3	// Asks the server for a connection ID (0), the SYN-ACK carries it
+#define OPT_NAME 4	// The name the server saves the file under when it writes uploads to a directory
+#define OPT_JOIN 5	// The connection ID of the first stream of the file a stream belongs to
+#define OPT_OFFSET 6	// The offset in the file of a stream's first byte
+#define OPT_ACK_VERSION 7	// The newest ACK format the client reads, the SYN-ACK carries the one the server sends
+#define OPT_MSS 8		// The client's MSS, the SYN-ACK carries the MSS agreed
+#define OPT_CHECKSUM 9		// The checksum covering the data, the SYN-ACK carries the one agreed
+#define OPT_ISN 10		// The sequence # of the first datagram, echoed in the SYN-ACK
+#define OPT_LENGTH 11		// The number of bytes the stream will send, the server preallocates them
+#define CHK_INET16 0		// The 16-bit one's complement sum
+#define CHK_NONE 1		// No checksum on data, for links that already have one
+#define OPT_RESUME 12		// Asks to resume, the SYN-ACK carries the bytes the server already has
+#define OPT_HASH 13		// Asks for the stream to be checked with a hash in the FIN, the SYN-ACK agrees
+#define HASH_FNV1A64 1		// The FNV-1a 64 hash of the stream's bytes
+#define OPT_STREAMS 14		// The number of streams the file is split into, sent by the first stream
+#define ACK_VERSION 1		// The newest ACK format the client reads
+#define ACK_EXT_LEN 28		// A version 1 ACK: the 8 byte ACK, then version, flags, rwnd, cumulative ACK, SACK bitmap
+#define ACK_BUFFER_SIZE ACK_EXT_LEN	// The longest ACK the client reads, anything longer is truncated
+#define SACK_BITS 64		// The datagrams after the cumulative ACK a SACK bitmap covers
+
+#ifndef UDP_SEGMENT
+#define UDP_SEGMENT 103
+#endif
+#define MODE_GBN 0
+#define MODE_SR 1
 
 const uint16_t pseudoChksum = 0b0000000000000000;
 const uint16_t ackFlag = 0b1010101010101010;
 const uint16_t dataFlag = 0b0101010101010101;   // (21,845) - base 10
 const uint16_t closeFlag = 0b1111111111111111;
-uint32_t sequenceNumber = 0;
+const uint16_t synFlag = 0b1100110011001100;
+const uint16_t synAckFlag = 0b0011001100110011;
+const uint16_t ackBusyFlag = 0b1010101001010101;  // An ACK from a server whose disk is falling behind
+const uint16_t ackExtFlag = 0b1010010110100101;   // An ACK in the versioned format (ACK_EXT_LEN bytes)
+const uint16_t probeFlag = 0b0000111100001111;    // A padded datagram probing if a size gets through, its sequence # is its length
+const uint16_t probeAckFlag = 0b1111000011110000; // The answer to a probe that arrived whole
+const uint16_t finAckFlag = 0b1100001111000011;   // The answer to a close, once the server has every byte
+const uint16_t connDataFlag = 0b0110011001100110;  // Data carrying a connection ID (CONN_HDR_LEN header)
+const uint16_t connCloseFlag = 0b1001100110011001; // Close carrying a connection ID (CONN_HDR_LEN header)
+
+// The IP MTUs probed below the MSS agreed: loopback, jumbo frames, Ethernet and the IPv6 minimum
+const int probeMtus[] = { 65535, 9000, 1500, 1280 };
+#define NUM_PROBE_MTUS (sizeof(probeMtus) / sizeof(probeMtus[0]))
+
+// The state of a stream, each stream's thread has its own
+__thread uint32_t sequenceNumber = 0;
+__thread int transferMode = MODE_GBN;
+__thread uint32_t connId = 0;                // The connection ID the server gave in the handshake, 0 if none
+__thread size_t headerLen = DATA_HDR_LEN;    // The length of each datagram's header, CONN_HDR_LEN with a connection ID
+__thread int ackVersion = 0;                 // The ACK format the server agreed to send, 0 for the 8 byte ACK
+__thread int chkAlgo = CHK_INET16;           // The checksum agreed to cover the data
+__thread int finAcked = 0;                   // If the server ACKs the close, which one that agreed an initial sequence # does
+__thread uint64_t resumeAt = 0;              // The bytes of the stream's range the server already has, which are skipped
+__thread int hashing = 0;                    // If the server agreed to check the stream's hash
+__thread uint64_t fileHash = FNV64_OFFSET;   // The FNV-1a 64 hash of the stream's bytes read so far
+
+/**
+ * timerEntry - a retransmission timer in the timer wheel
+ * @next: The next timer in the same bucket
+ * @prev: The previous timer in the same bucket
+ * @expiry: The monotonic time in microseconds the timer expires at
+ * @slot: The go back buffer slot of the datagram the timer is for
+ * @armed: If the timer is in the wheel
+ **/
+struct timerEntry {
+  struct timerEntry *next, *prev;
+  uint64_t expiry;
+  int slot;
+  uint8_t armed;
+};
+
+/**
+ * timerWheel - a hashed timer wheel. Each timer is kept in the bucket of the tick it expires in,
+ * so arming, cancelling and expiring a timer are O(1). Timers more than one revolution away share
+ * a bucket with nearer ones and are skipped until their expiry has passed.
+ * @buckets: The timers of each tick, as doubly linked lists
+ * @curTick: The tick the wheel has been advanced to
+ **/
+struct timerWheel {
+  struct timerEntry *buckets[WHEEL_SLOTS];
+  uint64_t curTick;
+};
+
+/**
+ * dgramInfo - bookkeeping for a datagram saved in the go back buffers
+ * @seq: The sequence number of the saved datagram
+ * @len: The length of the saved datagram including its header. Resends send exactly this many
+ * bytes, so the data may contain any byte value.
+ * @data: The datagram's data, in the mapped file or after the header in its send ring slot
+ * @acked: Selective repeat only - the datagram has been individually ACK'd
+ * @retransmitted: The datagram has been resent, so its ACK can't be timed (Karn's rule)
+ * @sentAt: The monotonic time in microseconds the datagram was first sent
+ * @timer: The datagram's retransmission timer
+ **/
+struct dgramInfo {
+  uint32_t seq;
+  uint16_t len;
+  const u_char *data;
+  uint8_t acked;
+  uint8_t retransmitted;
+  uint64_t sentAt;
+  struct timerEntry timer;
+};
+
+// Why a datagram taken from the socket is or isn't used as an ACK
+#define ACK_VALID 0
+#define ACK_NOT_ACK 1		// Not an ACK, or not in the format the handshake agreed
+#define ACK_BAD_CHKSUM 2	// A versioned ACK that failed its checksum
+
+/**
+ * ackInfo - what an ACK received says
+ * @status: ACK_VALID, or why the datagram is ignored
+ * @seq: The sequence # ACK'd
+ * @ext: If the ACK is in the versioned format, and the fields below are set
+ * @rwnd: The datagrams past the cumulative ACK the server can take
+ * @cumAck: The next sequence # the server needs in order
+ * @sack: Bit i is set if the server holds the datagram i + 1 after cumAck
+ **/
+struct ackInfo {
+  int status;
+  uint32_t seq;
+  uint8_t ext;
+  uint32_t rwnd;
+  uint32_t cumAck;
+  uint64_t sack;
+};
+
+/**
+ * sendRing - the go back buffers: one contiguous, cache aligned allocation of fixed stride slots.
+ * Each datagram is built in its slot and sent straight from it, the first time and when resent.
+ * @slots: The first slot
+ * @stride: The number of bytes from one slot to the next, a multiple of SLOT_ALIGN
+ * @numSlots: The number of slots
+ *
+ * Note: the length, sequence # and send time of the datagram in each slot are kept in the
+ * slot's dgramInfo
+ **/
+struct sendRing {
+  u_char *slots;
+  size_t stride;
+  int numSlots;
+};
+
+/**
+ * sendBatch - datagrams queued to be sent together with one sendmmsg call. The datagrams are
+ * not copied, each is gathered from two iovs: its header in its send ring slot, and its data
+ * in the mapped file (or in the slot after the header).
+ * @msgs: The queued messages
+ * @iovs: The header and data of each queued datagram
+ * @ctrls: The segment size of each message sent with segmentation offload
+ * @segLens: The length of the first datagram of each message
+ * @lastLens: The length of the last datagram of each message
+ * @count: The number of messages queued
+ * @numIovs: The number of iovs queued, two per datagram
+ * @gso: If runs of equal sized datagrams are sent as one message the kernel cuts apart (UDP_SEGMENT)
+ *
+ * Note: with gso the datagrams of a message are its consecutive iov pairs, every one as long
+ *   as the first except the last, which may be shorter.
+ **/
+struct sendBatch {
+  struct mmsghdr msgs[SEND_BATCH];
+  struct iovec iovs[2 * SEND_BATCH];
+  char ctrls[SEND_BATCH][CMSG_SPACE(sizeof(uint16_t))];
+  uint16_t segLens[SEND_BATCH];
+  uint16_t lastLens[SEND_BATCH];
+  int count;
+  int numIovs;
+  int gso;
+};
+
+/**
+ * rttEstimator - the smoothed round trip time the retransmission timeout is derived from (RFC 6298)
+ * @srtt: The smoothed round trip time in microseconds
+ * @rttvar: The round trip time variation in microseconds
+ * @rto: The current retransmission timeout in microseconds
+ * @minRto: The lower bound of the retransmission timeout
+ * @maxRto: The upper bound of the retransmission timeout
+ * @haveSample: If a round trip time has been measured yet
+ **/
+struct rttEstimator {
+  uint64_t srtt, rttvar, rto, minRto, maxRto;
+  uint8_t haveSample;
+};
+
+/**
+ * congestionCtl - a stream's congestion window, grown by ACKs and cut by losses. The stream
+ * keeps no more than the smaller of cwnd and N datagrams in flight, so N is only a cap.
+ * @algo: The strategy that grows and cuts the window
+ * @cwnd: The congestion window in datagrams
+ * @ssthresh: The slow start threshold in datagrams, the window grows by one per ACK below it
+ * @cap: N, the most the window grows to
+ * @wMax: CUBIC only - the window when the last loss happened
+ * @k: CUBIC only - the seconds from the start of the epoch until the window is back at wMax
+ * @renoWin: CUBIC only - the window Reno would have grown to since the start of the epoch
+ * @epochStart: CUBIC only - the monotonic time in microseconds the window began growing again, 0 if not yet
+ * @lastCut: The monotonic time in microseconds of the last cut. A datagram sent before it was
+ * lost in the same episode, so its loss doesn't cut the window again.
+ * @maxCwnd: The largest the window has been
+ * @losses: The number of cuts after duplicate ACKs
+ * @timeouts: The number of cuts after a retransmission timeout
+ **/
+struct congestionCtl {
+  const struct ccAlgo *algo;
+  double cwnd, ssthresh, cap;
+  double wMax, k, renoWin;
+  uint64_t epochStart, lastCut;
+  double maxCwnd;
+  unsigned long losses, timeouts;
+};
+
+/**
+ * pacer - a token bucket that spreads a stream's datagrams over the round trip, instead of
+ * sending everything the window allows back to back
+ * @rate: The bytes sent per second, 0 while unpaced
+ * @tokens: The bytes that may be sent now, negative after a datagram larger than what was left
+ * @depth: The most tokens saved up while idle, the largest burst sent
+ * @last: The monotonic time in microseconds tokens were last added
+ **/
+struct pacer {
+  double rate, tokens, depth;
+  uint64_t last;
+};
 
-FILE *fileToTransfer;
+/**
+ * ccAlgo - a congestion control strategy
+ * @name: The name given with -c
+ * @initWin: The window a stream starts with, 0 for N
+ * @onAck: Grows the window for datagrams newly ACK'd, given the time and the smoothed RTT
+ * @onLoss: Cuts the window after a loss
+ * @onTimeout: Cuts the window after a retransmission timeout, after onLoss if the loss is new
+ **/
+struct ccAlgo {
+  const char *name;
+  int initWin;
+  void (*onAck)(struct congestionCtl *cc, int numAcked, uint64_t now, uint64_t srtt);
+  void (*onLoss)(struct congestionCtl *cc);
+  void (*onTimeout)(struct congestionCtl *cc);
+};
+
+/**
+ * fileReader - the file being sent. A regular file is mapped whole and each segment is sent
+ * straight from its pages. Anything else is read FILE_BUFFER_SIZE bytes at a time, and each
+ * segment is copied out of the buffer into its send ring slot and checksummed by the same pass.
+ * @fd: The file descriptor of the file
+ * @buf: The bytes read but not yet sent, from start to end. The whole file when mapped
+ * @start: The offset of the next byte to send
+ * @end: The offset after the last byte read
+ * @eof: If the whole file has been read
+ * @mapped: If buf is the mapped file
+ * @size: The length of the mapping
+ **/
+struct fileReader {
+  int fd;
+  u_char *buf;
+  size_t start, end;
+  int eof;
+  int mapped;
+  size_t size;
+};
+
+__thread struct fileReader fileToTransfer;   // Each stream's thread reads its own byte range
+__thread struct impairState ackImpair;       // Each stream's decisions on which of its ACKs are impaired
+
+/**
+ * stream - one of the streams a file is sent over. Each stream has its own socket, handshake,
+ * sequence #s and window, and sends one byte range of the file.
+ * @index: The stream's index, 0 for the stream whose handshake starts the transfer
+ * @sockfd: The stream's socket
+ * @server_addr: Contains the info for the server
+ * @reader: The stream's byte range of the file
+ * @winSize: The window requested, lowered if the server accepted a smaller one
+ * @maxSegSize: The largest segment of data in a datagram
+ * @gso: If segmentation offload is used
+ * @rtt: The initial retransmission timeout and its bounds
+ * @thread: The stream's thread, streams after the first only
+ **/
+struct stream {
+  int index;
+  int sockfd;
+  struct sockaddr_in server_addr;
+  struct fileReader reader;
+  int winSize;
+  size_t maxSegSize;
+  int gso;
+  struct rttEstimator rtt;
+  pthread_t thread;
+};
+
+// Set by main before any stream is started
+int selectiveRepeat = 0;        // If selective repeat is requested
+char *uploadName = NULL;        // The name the server is asked to save the file under
+uint32_t firstConnId = 0;       // The connection ID of the first stream, which the other streams join
+int numStreams = 1;             // The streams the file is split into
+double maxPacingRate = 0;       // The bytes per second no stream is sent faster than, 0 for no cap
+int checksumAlgo = CHK_INET16;  // The checksum the server is asked to agree
+int resumeUpload = 0;           // If the server is asked to resume from what it already has
+int verifyHash = 0;             // If the server is asked to check the stream's hash
+int hashMismatch = 0;           // Set when the server says a stream's hash didn't match
+struct impairConfig ackImpairCfg;  // The artificial loss and corruption of the ACKs received
 
 /**
 * error - prints the value of errno & exit
@@ -59,50 +398,6 @@ void printDGram(u_char *dGram, int dGramLen, uint8_t withIndicies)
   }
 }
 
-/**
- * calcChecksum - calculate the checksum of the datagram to be sent
- * @sndDatagram: the datagram to calculate the checksum over
- * @nbytes: The number of bytes in the buffer
- * @sum: The variable to hold the checksum during computing
- *
- * Return: uint16_t - The checksum calculated
- **/
-uint16_t calcChecksum(u_char *sndDatagram, unsigned nbytes, uint32_t sum)
-{
-  uint i;
-
-  // Checksum all the pairs of bytes first...
-  for (i = 0; i < (nbytes & ~1U); i += 2) {
-    sum += (uint16_t)ntohs(*((uint16_t *)(sndDatagram + i)));
-    if (sum > 0xFFFF)
-      sum -= 0xFFFF;
-  }
-
-  /*
-   * If there's a single byte left over, checksum it, too.
-   * Network byte order is big-endian, so the remaining byte is
-   * the high byte.
-   */
-  if (i < nbytes) {
-    sum += sndDatagram[i] << 8;
-    if (sum > 0xFFFF)
-      sum -= 0xFFFF;
-  }
-
-  return (sum);
-}
-
-/**
- * addData - adds the data from the buffer to the datagram
- * @sndDatagram: The datagram to which the buffer data is being added
- * @buffer: The buffer the data is coming from
- * @buffDataLen: The length of the data in the buffer
- **/
-void addData(u_char *sndDatagram, char *fileBuffer, size_t maxSegSize)
-{
-  memcpy(&sndDatagram[8], fileBuffer, maxSegSize);
-}
-
 /**
  * addNewChksum - adds the computed checksum to the datagram
  * @sndDatagram: the datagram to which the checksum is being added
@@ -118,13 +413,15 @@ void addNewChksum(u_char *sndDatagram, uint16_t calcdChk)
 /**
  * makeHeader - makes the header for the datagram to be sent
  * @sndDatagram: the datagram buffer for the header to be placed
+ * @dataChk: The checksum of the datagram's data component, computed while it was copied in
  *
  * Note: The checksum is computed on a header with the pseudo-checksum
- * in the header component for the checksum   
+ * in the header component for the checksum. Only the headerLen header bytes are summed here,
+ * on top of the data's checksum. A connection ID follows the first 8 bytes when the server
+ * gave one.
  **/
-void makeHeader(u_char *sndDatagram, int dGramLen)
+void makeHeader(u_char *sndDatagram, uint16_t dataChk)
 {
-  uint32_t sum=0;
   uint16_t calcdChk=0;
   sndDatagram[0] = sequenceNumber >> 24;
   sndDatagram[1] = sequenceNumber >> 16;
@@ -132,10 +429,20 @@ void makeHeader(u_char *sndDatagram, int dGramLen)
   sndDatagram[3] = sequenceNumber;
   sndDatagram[4] = pseudoChksum >> 8;
   sndDatagram[5] = pseudoChksum;
-  sndDatagram[6] = dataFlag >> 8;
-  sndDatagram[7] = dataFlag;
+  if(connId != 0) {
+    sndDatagram[6] = connDataFlag >> 8;
+    sndDatagram[7] = connDataFlag & 0xFF;
+    sndDatagram[8] = connId >> 24;
+    sndDatagram[9] = connId >> 16;
+    sndDatagram[10] = connId >> 8;
+    sndDatagram[11] = connId;
+  } else {
+    sndDatagram[6] = dataFlag >> 8;
+    sndDatagram[7] = dataFlag & 0xFF;
+  }
 
-  calcdChk = calcChecksum(sndDatagram, dGramLen+8, sum);
+  // Without a checksum the field is left 0
+  if(chkAlgo == CHK_INET16) calcdChk = calcChecksum(sndDatagram, headerLen, dataChk);
 
   addNewChksum(sndDatagram, calcdChk);  
 
@@ -163,341 +470,1440 @@ ssize_t sendDatagram(int *sockfd, struct sockaddr_in *server_addr, u_char *sndDa
 }
 
 /**
- * verifyACK - verifys the ACK'd seq # received from the server
+ * seqDist - the number of sequence #s from one sequence # to another
+ * @from: The earlier sequence #
+ * @to: The later sequence #
+ *
+ * Note: sequence #s use the whole 32 bits and wrap from UINT32_MAX to 0 (serial number
+ * arithmetic, RFC 1982). Every sequence # is compared by its distance from the window base,
+ * which is correct across the wrap as long as the window is less than 2^31.
+ *
+ * Return uint32_t - the distance, wrapping if to is before from
+ **/
+uint32_t seqDist(uint32_t from, uint32_t to)
+{
+  return to - from;
+}
+
+/**
+ * verifyACK - verifys the ACK'd seq # received from the server. ACKs are cumulative, so an ACK
+ * covers every datagram in flight up to and including its sequence #
  * @lastSeqACKd: The last sequence # ACKd
  * @ackdSeqNum: The sequence # received in the ACK
+ * @baseSeqNum: The sequence # of the earliest datagram that has yet to be ACK'd
+ * @numInFlight: The number of datagrams that have yet to be ACK'd
  *
- * Note: If the sequence number is USHRT_MAX then the datagram received was not
- * an ACK.
+ * Return int - the number of datagrams newly ACK'd, 0 for a duplicate of the last ACK and
+ * -1 if the ACK should be ignored
  **/
-int verifyACK(uint32_t lastSeqACKd, uint32_t ackdSeqNum)
+int verifyACK(uint32_t lastSeqACKd, uint32_t ackdSeqNum, uint32_t baseSeqNum, int numInFlight)
 {
-  if (ackdSeqNum == USHRT_MAX) { 
-
-#ifdef DEBUG
-    printf("The received datagram was not an ACK\n\n");
-#endif
+  uint32_t dist;
 
-    return 0;
-  }
-  if(lastSeqACKd == USHRT_MAX && ackdSeqNum == 0) {
+  if(ackdSeqNum == lastSeqACKd) {
 
 #ifdef DEBUG
-    printf("Seq # %u has been acknowledged\n\n", ackdSeqNum);
+    printf("Duplicate ACK for seq # %u\n", ackdSeqNum);
 #endif
 
-    return 1;
+    return 0;
   }
-  if(lastSeqACKd >= ackdSeqNum) {
+  dist = seqDist(baseSeqNum, ackdSeqNum);
+  if(dist >= (uint32_t)numInFlight) {
 
 #ifdef DEBUG
     printf("lastACKd= %d, recentACK= %d\n", lastSeqACKd, ackdSeqNum);
 #endif
 
-    return 0;
+    return -1;
   }
 
 #ifdef DEBUG
-  printf("Seq # %u has been acknowledged\n\n", ackdSeqNum);
+  printf("Seq #s %u - %u have been acknowledged\n\n", baseSeqNum, ackdSeqNum);
 #endif
 
-  return 1;
+  return dist + 1;
 }
 
 /**
- * getAck - receives the ACK from the server for the datagram sent.
+ * getWord - reads a 32-bit value in network byte order
+ * @buf: Where the value is
+ *
+ * Return: uint32_t - the value
+ **/
+static inline uint32_t getWord(const u_char *buf)
+{
+  return ((uint32_t) buf[0] << 24) | (buf[1] << 16) | (buf[2] << 8) | buf[3];
+}
+
+/**
+ * getAcks - receives the ACKs waiting on the socket, as many as fit in one recvmmsg call
  * @sockfd: The file descriptor for the socket
- * @server_addr: Contains the info for the server
- * @clientLen: TBD
+ * @acks: Filled with what each ACK says
+ * @receiverBusy: Set by each ACK received: 1 if it asks the client to slow down, 0 if not
  *
- * Note: If the ack received does not have to appropriate flag in the header USHRT_MAX will be returned
+ * Note: If a datagram received is not an ACK in the format the handshake agreed, or a
+ * versioned ACK fails its checksum, its status says so. The checksum of an 8 byte ACK isn't
+ * checked, older servers leave it 0. An ACK lost by the artificial impairment is ignored like a
+ * datagram that isn't an ACK.
  *
- * Return: uint32_t - the sequence # received in the ACK
+ * Return: int - the number of datagrams received, 0 once there are none waiting
  **/
-uint32_t getAck(int *sockfd, struct sockaddr_in *server_addr, socklen_t *clientLen)
+int getAcks(int *sockfd, struct ackInfo *acks, int *receiverBusy)
 {
-  int recsize;
+  int numRecvd;
   uint32_t seqRecvd, chkRecvd, flagRecvd;
-  u_char recvdDatagram[BUFFER_SIZE] = {0};    // Buffer for receiving datagram
+  u_char recvdDatagrams[ACK_BATCH][ACK_BUFFER_SIZE];    // Buffers for receiving datagrams
+  struct mmsghdr msgs[ACK_BATCH];
+  struct iovec iovs[ACK_BATCH];
+
+  memset(msgs, 0, sizeof(msgs));
+  for(int i = 0; i < ACK_BATCH; i++) {
+    iovs[i].iov_base = recvdDatagrams[i];
+    iovs[i].iov_len = ACK_BUFFER_SIZE;
+    msgs[i].msg_hdr.msg_iov = &iovs[i];
+    msgs[i].msg_hdr.msg_iovlen = 1;
+  }
 
-  recsize = recvfrom(*sockfd, (void*)recvdDatagram, BUFFER_SIZE, 0, (struct sockaddr*)&server_addr, clientLen);
-  if (recsize < 0) error("ERROR on recvfrom");
+  numRecvd = recvmmsg(*sockfd, msgs, ACK_BATCH, MSG_DONTWAIT, NULL);
+  if (numRecvd < 0) {
+    if (errno == EAGAIN || errno == EWOULDBLOCK) return 0;
+    error("ERROR on recvmmsg");
+  }
+
+  for(int i = 0; i < numRecvd; i++) {
+    u_char *recvdDatagram = recvdDatagrams[i];
 
 #ifdef DEBUG
-  printf("receivesize: %d\n", recsize);
+    printf("receivesize: %u\n", msgs[i].msg_len);
 #endif
 
-  seqRecvd = (recvdDatagram[0] <<  24) | (recvdDatagram[1] << 16) | (recvdDatagram[2] << 8) | recvdDatagram[3];
-  chkRecvd = (recvdDatagram[4] << 8) | recvdDatagram[5];
-  flagRecvd = (recvdDatagram[6] << 8) | recvdDatagram[7];
+    if(impairDatagram(&ackImpair, recvdDatagram, msgs[i].msg_len) & IMPAIR_DROP) {
+      acks[i].status = ACK_NOT_ACK;
+      acks[i].ext = 0;
+      continue;
+    }
+
+    seqRecvd = getWord(recvdDatagram);
+    chkRecvd = (recvdDatagram[4] << 8) | recvdDatagram[5];
+    flagRecvd = (recvdDatagram[6] << 8) | recvdDatagram[7];
 
 #ifdef DEBUG
-  printf("Ack's Seq: %u, Chk: %u, Flag: %u\n", seqRecvd, chkRecvd, flagRecvd); 
+    printf("Ack's Seq: %u, Chk: %u, Flag: %u\n", seqRecvd, chkRecvd, flagRecvd); 
 #endif
 
-  if (flagRecvd == ackFlag) {
+    acks[i].status = ACK_NOT_ACK;
+    acks[i].seq = seqRecvd;
+    acks[i].ext = 0;
+    if(ackVersion == 0) {
+      if(msgs[i].msg_len >= 8 && (flagRecvd == ackFlag || flagRecvd == ackBusyFlag)) {
+        acks[i].status = ACK_VALID;
+        *receiverBusy = (flagRecvd == ackBusyFlag);
+      }
+      continue;
+    }
 
-#ifdef DEBUG
-    printf("The ACK for seq # %d was received\n", seqRecvd);
-#endif
+    if(msgs[i].msg_len < ACK_EXT_LEN || flagRecvd != ackExtFlag || recvdDatagram[8] != 1) continue;
+    recvdDatagram[4] = pseudoChksum >> 8;
+    recvdDatagram[5] = pseudoChksum;
+    if(calcChecksum(recvdDatagram, ACK_EXT_LEN, 0) != chkRecvd) {
+      acks[i].status = ACK_BAD_CHKSUM;
+      continue;
+    }
 
-    return seqRecvd;
+    acks[i].status = ACK_VALID;
+    acks[i].ext = 1;
+    acks[i].rwnd = getWord(&recvdDatagram[12]);
+    acks[i].cumAck = getWord(&recvdDatagram[16]);
+    acks[i].sack = ((uint64_t) getWord(&recvdDatagram[20]) << 32) | getWord(&recvdDatagram[24]);
+    *receiverBusy = recvdDatagram[9] & 1;
   }
-  return USHRT_MAX;
+  return numRecvd;
 }
 
 /**
- * clearBuffers - clears the buffers being used for each round of datagra / ACK interations
- * @sndDatagram: The datagram buffer to be nulled
- * @fileBuffer: The buffer storing the file's lines to be nulled
- * @maxSegSize: the maximum size of the buffers
+ * batchSplit - turns segmentation offload off and gives every unsent datagram its own message
+ * @batch: The queued datagrams
+ * @first: The first message not yet sent
  **/
-void clearBuffers(u_char *sndDatagram, char *fileBuffer, size_t maxSegSize)
+void batchSplit(struct sendBatch *batch, int first)
 {
-  memset(sndDatagram, 0, maxSegSize+8);
-  memset(fileBuffer, 0, maxSegSize);  
+  struct msghdr *hdr = &batch->msgs[first].msg_hdr;
+  void *name = hdr->msg_name;
+  int iov = hdr->msg_iov - batch->iovs;
+
+  batch->gso = 0;
+  batch->count = first;
+  for(; iov < batch->numIovs; iov += 2, batch->count++) {
+    hdr = &batch->msgs[batch->count].msg_hdr;
+    memset(hdr, 0, sizeof(*hdr));
+    hdr->msg_name = name;
+    hdr->msg_namelen = sizeof(struct sockaddr_in);
+    hdr->msg_iov = &batch->iovs[iov];
+    hdr->msg_iovlen = 2;
+  }
 }
 
 /**
- * closeConnection - closes the connection to the server using the predefined close flag
+ * batchFlush - sends every queued datagram, with as few sendmmsg calls as possible
+ * @batch: The queued datagrams
  * @sockfd: The file descriptor for the socket
- * @server_addr: Contains the info for the server
- * @sndDatagram: The datagram being sent to close the connection
  **/
-void closeConnection(int *sockfd, struct sockaddr_in *server_addr, u_char *sndDatagram)
+void batchFlush(struct sendBatch *batch, int *sockfd)
 {
-  printf("Client: closing connection\n");
-	
-  sndDatagram[0] = sequenceNumber >> 24;
-  sndDatagram[1] = sequenceNumber >> 16;
-  sndDatagram[2] = sequenceNumber >> 8;
-  sndDatagram[3] = sequenceNumber;
-  sndDatagram[4] = pseudoChksum >> 8;
-  sndDatagram[5] = pseudoChksum;
-  sndDatagram[6] = closeFlag >> 8;
-  sndDatagram[7] = closeFlag;
+  int numSent = 0, sent;
+  struct msghdr *hdr;
+  struct cmsghdr *cmsg;
+
+  for(int i = 0; i < batch->count; i++) {
+    hdr = &batch->msgs[i].msg_hdr;
+    if(hdr->msg_iovlen <= 2) continue;
+
+    hdr->msg_control = batch->ctrls[i];
+    hdr->msg_controllen = sizeof(batch->ctrls[i]);
+    cmsg = CMSG_FIRSTHDR(hdr);
+    cmsg->cmsg_level = SOL_UDP;
+    cmsg->cmsg_type = UDP_SEGMENT;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+    *(uint16_t*) CMSG_DATA(cmsg) = batch->segLens[i];
+  }
 
-  sendDatagram(sockfd, server_addr, sndDatagram, 8);
+  while(numSent < batch->count) {
+    sent = sendmmsg(*sockfd, &batch->msgs[numSent], batch->count - numSent, 0);
+    if(sent < 0 && batch->gso && (errno == EIO || errno == EINVAL || errno == ENOPROTOOPT || errno == EOPNOTSUPP)) {
+      // The route can't offload the segmentation (e.g. no checksum offload), send them one by one
+      printf("Segmentation offload failed, sending datagrams individually\n");
+      batchSplit(batch, numSent);
+      continue;
+    }
+    if(sent < 0) error("Error sending the packets:");
+    numSent += sent;
+  }
+  batch->count = 0;
+  batch->numIovs = 0;
 }
 
 /**
- * readFile - reads from the file and stores it in the file buffer
- * @fileBuffer - the buffer to store the read contents
- * @numToRead - the number of char sized bytes to read
- *
- * Return size_t - the number successfully read
+ * batchAdd - queues a datagram to be sent with the next batchFlush, flushing first if the batch is full
+ * @batch: The queued datagrams
+ * @sockfd: The file descriptor for the socket
+ * @server_addr: Contains the info for the server
+ * @header: The datagram's headerLen byte header, which must be unchanged until it is sent
+ * @data: The datagram's data, which must be unchanged until it is sent
+ * @dataLen: The length of the datagram's data
  **/
-size_t readFile(char *fileBuffer, size_t numToRead) {
-  return fread((void*)fileBuffer, sizeof(char), numToRead, fileToTransfer);
+void batchAdd(struct sendBatch *batch, int *sockfd, struct sockaddr_in *server_addr, u_char *header,
+    const u_char *data, int dataLen)
+{
+  struct mmsghdr *msg;
+  struct msghdr *last;
+  size_t segSize, datagramLen = dataLen + headerLen, numDgrams;
+  int m;
+
+  if(batch->numIovs == 2 * SEND_BATCH) batchFlush(batch, sockfd);
+  batch->iovs[batch->numIovs].iov_base = header;
+  batch->iovs[batch->numIovs].iov_len = headerLen;
+  batch->iovs[batch->numIovs + 1].iov_base = (void*) data;
+  batch->iovs[batch->numIovs + 1].iov_len = dataLen;
+  batch->numIovs += 2;
+
+  // Appends to the last message while it is a run of full segments the new datagram fits behind
+  if(batch->gso && batch->count > 0) {
+    m = batch->count - 1;
+    last = &batch->msgs[m].msg_hdr;
+    segSize = batch->segLens[m];
+    numDgrams = last->msg_iovlen / 2;
+    if(batch->lastLens[m] == segSize && datagramLen <= segSize &&
+        numDgrams < GSO_MAX_SEGS && numDgrams * segSize + datagramLen <= GSO_MAX_BYTES) {
+      last->msg_iovlen += 2;
+      batch->lastLens[m] = datagramLen;
+      return;
+    }
+  }
+
+  msg = &batch->msgs[batch->count];
+  memset(msg, 0, sizeof(*msg));
+  msg->msg_hdr.msg_name = server_addr;
+  msg->msg_hdr.msg_namelen = sizeof(*server_addr);
+  msg->msg_hdr.msg_iov = &batch->iovs[batch->numIovs - 2];
+  msg->msg_hdr.msg_iovlen = 2;
+  batch->segLens[batch->count] = datagramLen;
+  batch->lastLens[batch->count] = datagramLen;
+  batch->count++;
 }
 
 /**
- * startTimer - starts the timer for retransmission
- * @timer - the timer being initialized
- **/ 
-void startTimer(struct timeval *timer) {
-  if(gettimeofday(timer, NULL) != 0) error("ERROR: gettimeofday failed");
+ * addOption - appends a handshake option to the data of a SYN
+ * @dGram: The SYN being built
+ * @off: The offset in the datagram the option is written at
+ * @type: The option's type
+ * @len: The number of bytes in the option's value
+ * @value: The option's value, written in network byte order
+ *
+ * Return size_t - the offset following the option
+ **/
+size_t addOption(u_char *dGram, size_t off, uint8_t type, uint8_t len, uint64_t value)
+{
+  dGram[off++] = type;
+  dGram[off++] = len;
+  for(int i = len - 1; i >= 0; i--) dGram[off++] = value >> (8*i);
+  return off;
 }
 
 /**
- * hasTimerExpired - determines if the timer has exceeded the timeout
- * @timer - the timer being evaluated
+ * getOption - finds an option in the data of a SYN-ACK
+ * @dGram: The SYN-ACK received
+ * @dGramLen: The length of the SYN-ACK including its header
+ * @type: The option's type
+ * @value: Set to the option's value if it was found
  *
- * Return int - 1 if it has expired, 0 otherwise
+ * Return int - 1 if the option was found, 0 otherwise
  **/
-int hasTimerExpired(struct timeval *timer)
+int getOption(u_char *dGram, size_t dGramLen, uint8_t type, uint64_t *value)
 {
-  struct timeval currentTime;
+  size_t off = 8;
 
-  if(timer->tv_sec == -1) return 0;
-  if(gettimeofday(&currentTime, NULL) != 0) error("ERROR: gettimeofday failed");
-  if(difftime(currentTime.tv_sec, timer->tv_sec) > TIMEOUT) return 1;
+  while(off + 2 <= dGramLen && off + 2 + dGram[off+1] <= dGramLen) {
+    if(dGram[off] == type && dGram[off+1] <= 8) {
+      *value = 0;
+      for(int i = 0; i < dGram[off+1]; i++) *value = (*value << 8) | dGram[off+2+i];
+      return 1;
+    }
+    off += 2 + dGram[off+1];
+  }
   return 0;
 }
 
 /**
- * areThereACKs - polls to see if there are ACKs that have been received
- * @maxfd - the maximum file descriptor size in rset
- * @allset - all possible file descriptors for reading & writing
- * @rset - the set of file descriptors to be checked for possible ACKs
- * @timeout - how long select should poll for ACKS - 0 == none blocking
+ * negotiateMode - asks the server for a session by sending a SYN: a transfer mode, window, MSS,
+ * checksum, initial sequence #, a connection ID and optionally the name to save the file under
+ * @st: The stream, whose window and MSS are lowered if the server agreed smaller ones
+ * @mode: The transfer mode requested
+ * @name: The name the file is saved under, NULL for the server's choice
+ * @joinId: The connection ID of the file's first stream, 0 for the first stream
+ * @mssAgreed: Set to 1 if the server agreed an MSS, 0 if it takes no datagram over BUFFER_SIZE
  *
- * Return - The number for file descriptors ready for reading
+ * Note: A SYN carries the sequence # USHRT_MAX, which servers without the handshake (whose
+ * sequence #s wrapped before it) never expect, so they discard it and never answer. Go-Back-N is used when no SYN-ACK arrives.
+ * A server that gives a connection ID sets connId and headerLen. A server that echoes the
+ * random initial sequence # starts sequenceNumber at it and ACKs the close, the others expect 0.
+ * The number of bytes the stream sends is only known, and sent for the server to preallocate,
+ * for a mapped file.
+ *
+ * Return int - the transfer mode the server agreed to
  **/
-int areThereACKs(int maxfd, fd_set *allset, fd_set *rset, struct timeval *timeout)
+int negotiateMode(struct stream *st, int mode, const char *name, uint32_t joinId, int *mssAgreed)
 {
-  int nready;
+  u_char synDatagram[BUFFER_SIZE] = {0};
+  u_char recvdDatagram[BUFFER_SIZE];
+  size_t synLen = 8;
+  ssize_t recsize;
+  uint16_t chkRecvd;
+  uint64_t window, agreedMode, id;
+  uint32_t isn, synSeq = USHRT_MAX;
+  fd_set rset;
+  struct timeval timeout;
+
+  if(getrandom(&isn, sizeof(isn), 0) != sizeof(isn)) isn = time(NULL) ^ getpid();
+
+  synDatagram[0] = synSeq >> 24;
+  synDatagram[1] = synSeq >> 16;
+  synDatagram[2] = synSeq >> 8;
+  synDatagram[3] = synSeq;
+  synDatagram[6] = synFlag >> 8;
+  synDatagram[7] = synFlag & 0xFF;
+  synLen = addOption(synDatagram, synLen, OPT_MODE, 1, mode);
+  synLen = addOption(synDatagram, synLen, OPT_WINDOW, 4, st->winSize);
+  synLen = addOption(synDatagram, synLen, OPT_CONNID, 4, 0);
+  synLen = addOption(synDatagram, synLen, OPT_ACK_VERSION, 1, ACK_VERSION);
+  synLen = addOption(synDatagram, synLen, OPT_MSS, 4, st->maxSegSize);
+  synLen = addOption(synDatagram, synLen, OPT_CHECKSUM, 1, checksumAlgo);
+  synLen = addOption(synDatagram, synLen, OPT_ISN, 4, isn);
+  if(st->reader.mapped) synLen = addOption(synDatagram, synLen, OPT_LENGTH, 8, st->reader.end - st->reader.start);
+  if(resumeUpload) synLen = addOption(synDatagram, synLen, OPT_RESUME, 1, 1);
+  if(verifyHash) synLen = addOption(synDatagram, synLen, OPT_HASH, 1, HASH_FNV1A64);
+  *mssAgreed = 0;
+  if(name != NULL) {
+    synDatagram[synLen++] = OPT_NAME;
+    synDatagram[synLen++] = strlen(name);
+    memcpy(&synDatagram[synLen], name, strlen(name));
+    synLen += strlen(name);
+  }
+  // The server keeps the first stream's file until every stream has joined it. A stream after
+  // the first writes its byte range into that file.
+  if(joinId == 0 && numStreams > 1) synLen = addOption(synDatagram, synLen, OPT_STREAMS, 1, numStreams);
+  if(joinId != 0) {
+    synLen = addOption(synDatagram, synLen, OPT_JOIN, 4, joinId);
+    synLen = addOption(synDatagram, synLen, OPT_OFFSET, 8, st->reader.start);
+  }
+  addNewChksum(synDatagram, calcChecksum(synDatagram, synLen, 0));
+
+  for(int i = 0; i < HANDSHAKE_TRIES; i++) {
+    sendDatagram(&st->sockfd, &st->server_addr, synDatagram, synLen);
+
+    timeout.tv_sec = HANDSHAKE_TIMEOUT;
+    timeout.tv_usec = 0;
+    FD_ZERO(&rset);
+    FD_SET(st->sockfd, &rset);
+    if(select(st->sockfd+1, &rset, NULL, NULL, &timeout) <= 0) continue;
+
+    recsize = recvfrom(st->sockfd, (void*)recvdDatagram, BUFFER_SIZE, 0, NULL, NULL);
+    if(recsize < 8 || ((recvdDatagram[6] << 8) | recvdDatagram[7]) != synAckFlag) continue;
+
+    chkRecvd = (recvdDatagram[4] << 8) | recvdDatagram[5];
+    recvdDatagram[4] = pseudoChksum >> 8;
+    recvdDatagram[5] = pseudoChksum;
+    if(calcChecksum(recvdDatagram, recsize, 0) != chkRecvd) continue;
+
+    if(!getOption(recvdDatagram, recsize, OPT_MODE, &agreedMode)) agreedMode = MODE_GBN;
+    if(getOption(recvdDatagram, recsize, OPT_WINDOW, &window) && window > 0 && window < (uint64_t) st->winSize) 
+      st->winSize = window;
+    if(getOption(recvdDatagram, recsize, OPT_CONNID, &id) && id != 0) {
+      connId = id;
+      headerLen = CONN_HDR_LEN;
+    }
+    // A server that doesn't name a format sends the 8 byte ACK
+    if(getOption(recvdDatagram, recsize, OPT_ACK_VERSION, &id) && id <= ACK_VERSION) ackVersion = id;
+    if(getOption(recvdDatagram, recsize, OPT_MSS, &id) && id > 0) {
+      if(id < st->maxSegSize) st->maxSegSize = id;
+      *mssAgreed = 1;
+    }
+    if(getOption(recvdDatagram, recsize, OPT_CHECKSUM, &id) && id == CHK_NONE) chkAlgo = CHK_NONE;
+    if(getOption(recvdDatagram, recsize, OPT_ISN, &id) && id == isn) {
+      sequenceNumber = isn;
+      finAcked = 1;
+    }
+    if(resumeUpload && getOption(recvdDatagram, recsize, OPT_RESUME, &id)) resumeAt = id;
+    if(getOption(recvdDatagram, recsize, OPT_HASH, &id) && id == HASH_FNV1A64) hashing = 1;
+    return agreedMode;
+  }
 
-  *rset = *allset;    // needs to be reset each time
-  nready = select( maxfd, rset, NULL, NULL,  timeout);
-  if(nready < 0) error("ERROR: select failed");
-  return nready;
+  printf("Client: the server did not answer the SYN, using Go-Back-N\n");
+  return MODE_GBN;
 }
 
 /**
- * savePacket - saves an non ACKd packet for possible retransmission
- * @sndDatagram - the packet to be saved
- * @goBackDgram - the buffers storing the saved sndDatagrams
- * @goBackDgramPtr - where the current packet should be saved in the buffers
- * @maxSegsize - the maximum amount of data stored in the datagram
+ * openFile - opens the file to transfer, mapping it if it is a regular file
+ * @fileName - the name of the file
  **/
-void savePacket(u_char *sndDatagram, u_char **goBackDgrams, int goBackDgramPtr, size_t maxSegSize)
+void openFile(const char *fileName)
 {
- for(size_t i = 0; i<maxSegSize+8; i++) {
-    goBackDgrams[goBackDgramPtr][i] = sndDatagram[i];
+  struct fileReader *reader = &fileToTransfer;
+  struct stat st;
+  void *map;
+
+  reader->fd = open(fileName, O_RDONLY);
+  if(reader->fd < 0) error("Error opening the file to tranfer");
+
+  if(fstat(reader->fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0 && (uint64_t) st.st_size <= SIZE_MAX) {
+    map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, reader->fd, 0);
+    if(map != MAP_FAILED) {
+      madvise(map, st.st_size, MADV_SEQUENTIAL);   // Read ahead, pages behind may be dropped
+      reader->buf = (u_char*) map;
+      reader->end = st.st_size;
+      reader->size = st.st_size;
+      reader->eof = 1;
+      reader->mapped = 1;
+      return;
+    }
   }
+
+  // Pipes, devices, empty files, or files too big to map are read into a buffer
+  reader->buf = (u_char*) malloc(FILE_BUFFER_SIZE);
+  if(reader->buf == NULL) error("File buffer memory allocation failure\n");
 }
 
 /**
- * resendDgrams - resends all saved datagrams that have yet to be ACKd
- * @goBackDgrams - the buffers storing the datagrams to be resent
- * @sockfd - the socket file descriptor
- * @server_addr - the server socket information
- * @maxSegSize - the maximum amount of data stored in a datagram
- * @goBackDgraPtr - the next buffer to be replaced (The earliest saved buffer that hasn't been ACKd)
- * @sndDatasize - the size of a send datagram buffer
- * @winSize - the number of buffers saved before being replaced
- * @totalNumDgramsSent - the total number of original datagrams that have been sent
- **/
-void resendDgrams(u_char **goBackDgrams, int *sockfd, struct sockaddr_in *server_addr, size_t maxSegSize, 
-    int goBackDgramPtr, int sndDataSize, int winSize, int totalNumDgramsSent)
-{
-  int i, dGramLen = -1, numResent = 0, numToResend = 0;
-  ssize_t resentSize;
-  size_t j;
-  uint32_t seqResent;
-  u_char *sndDatagram = (u_char*) calloc(sndDataSize, sizeof(u_char));
-
-  if(sndDatagram == NULL) error("Datagram memory allocation failure\n");
-  if(totalNumDgramsSent < winSize) numToResend = totalNumDgramsSent;
-  else numToResend = winSize;
-
-  for(i = goBackDgramPtr; numResent < numToResend; i++) {
-    if(i >= numToResend) i = 0;
-    for(j = 0; j<maxSegSize+8; j++) {
-      sndDatagram[j] = goBackDgrams[i][j];
-      if(dGramLen == -1 && j>=8 && sndDatagram[j] == 0) dGramLen = j;
-    }
-    if(dGramLen == -1) dGramLen = maxSegSize+8;
+ * closeFile - unmaps or frees the file to transfer and closes it
+ **/
+void closeFile(void)
+{
+  struct fileReader *reader = &fileToTransfer;
 
-    seqResent = (sndDatagram[0] <<  24) | (sndDatagram[1] << 16) | (sndDatagram[2] << 8) | sndDatagram[3];
+  if(reader->mapped) munmap(reader->buf, reader->size);
+  else free(reader->buf);
+  close(reader->fd);
+}
 
-    resentSize = sendDatagram(sockfd, server_addr, (void*)sndDatagram, dGramLen);  
+/**
+ * readFile - finds the next bytes of the file and their checksum. A mapped file's bytes are
+ * summed in place, otherwise they are copied into the data component of a send ring slot and
+ * summed by the same pass.
+ * @fileBuffer - the data component of a send ring slot, the bytes are copied here if the file isn't mapped
+ * @numToRead - the number of char sized bytes to read
+ * @data - set to where the bytes read are, in the mapped file or fileBuffer
+ * @dataChk - set to the checksum of the bytes read, 0 when the data has none
+ *
+ * Note: the bytes left in the file buffer are moved to its front before it is refilled, so
+ *   every segment is copied out of one contiguous run.
+ *
+ * Return size_t - the number successfully read
+ **/
+size_t readFile(u_char *fileBuffer, size_t numToRead, const u_char **data, uint16_t *dataChk) {
+  struct fileReader *reader = &fileToTransfer;
+  ssize_t numRead;
+
+  if(reader->end - reader->start < numToRead && !reader->eof) {
+    memmove(reader->buf, reader->buf + reader->start, reader->end - reader->start);
+    reader->end -= reader->start;
+    reader->start = 0;
+
+    while(reader->end < FILE_BUFFER_SIZE) {
+      numRead = read(reader->fd, reader->buf + reader->end, FILE_BUFFER_SIZE - reader->end);
+      if(numRead < 0 && errno == EINTR) continue;
+      if(numRead < 0) error("Error reading the file to transfer");
+      if(numRead == 0) {
+        reader->eof = 1;
+        break;
+      }
+      reader->end += numRead;
+    }
+  }
 
-    printf("Timeout, sequence number = %u\n", seqResent);
+  if(numToRead > reader->end - reader->start) numToRead = reader->end - reader->start;
+  *dataChk = 0;
+  if(reader->mapped) {
+    *data = reader->buf + reader->start;
+    if(chkAlgo == CHK_INET16) *dataChk = calcChecksum(*data, numToRead, 0);
+  } else {
+    *data = fileBuffer;
+    if(chkAlgo == CHK_INET16) *dataChk = copyChecksum(fileBuffer, reader->buf + reader->start, numToRead, 0);
+    else memcpy(fileBuffer, reader->buf + reader->start, numToRead);
+  }
+  if(hashing) fileHash = fnv1a64(fileHash, *data, numToRead);
+  reader->start += numToRead;
+  return numToRead;
+}
 
-#ifdef DEBUG
-    printf("resentSize: %d\n", resentSize);
-#endif
+/**
+ * skipFile - passes over bytes of the file the server already has, hashing them
+ * @numToSkip - the number of bytes
+ **/
+void skipFile(uint64_t numToSkip)
+{
+  struct fileReader *reader = &fileToTransfer;
+  u_char *scratch;
+  const u_char *data;
+  uint16_t chk;
+  size_t numRead;
+
+  if(reader->mapped) {
+    if(numToSkip > reader->end - reader->start) numToSkip = reader->end - reader->start;
+    if(hashing) fileHash = fnv1a64(fileHash, reader->buf + reader->start, numToSkip);
+    reader->start += numToSkip;
+    return;
+  }
 
-    memset(sndDatagram, 0, maxSegSize+8);
-    numResent++;
-    dGramLen = -1;
+  scratch = (u_char*) malloc(FILE_BUFFER_SIZE);
+  if(scratch == NULL) error("Skip buffer memory allocation failure\n");
+  while(numToSkip > 0) {
+    numRead = readFile(scratch, numToSkip < FILE_BUFFER_SIZE ? numToSkip : FILE_BUFFER_SIZE, &data, &chk);
+    if(numRead == 0) break;
+    numToSkip -= numRead;
   }
-  free(sndDatagram);
+  free(scratch);
 }
 
-int main(int argc, char *argv[])
+/**
+ * monotonicUsec - reads the monotonic clock
+ *
+ * Return uint64_t - the current time in microseconds
+ **/
+uint64_t monotonicUsec(void)
 {
-	// The socket file descriptor, port number, and the number of chars read/written
-  int sockfd, portno, winSize, currentWin, sndDataSize, fileBufferSize, goBackDgramPtr = 0, noMoreData = 0, totalNumDgramsSent = 0;
-  size_t maxSegSize, numRead = 0;
-  ssize_t sendSize;
-  u_char *sndDatagram;      // The buffer storing each datagram before it is sent
-  char *fileBuffer;         // Buffer storing the file data for each datagram
-  struct sockaddr_in server_addr;             // Sockadder_in struct that stores the IP address, port, and etc of the server.
-  socklen_t clientLen;                        // Stores the size of the clients sockaddr_in 
-  struct hostent *server;                     // Hostent struct that keeps relevant host info. Such as official name and address family.
-  char *host_name, *file_name;                // The host name and file name retrieve from command line
-  u_char **goBackDgrams;
-  uint32_t lastSeqACKd = USHRT_MAX, acksSeq, lastSeqSent=-1;
-
-  // START select() - Used by select() to poll if there are ACKs to be read
-  fd_set rset;              // File descriptors that might be ready to read
-  fd_set allset;            // Set of all file descriptors
-  int maxfd;                // Max file descriptor of sets (will need to be incremented by 1)
-  struct timeval timeout;   // Specifies how long select should wait. 0 for both elements == no block
-  timeout.tv_sec = 0;       // Represents the number of whole seconds of elapsed time
-  timeout.tv_usec = 0;      // The rest of the elapsed time (a fraction of a second), represented as the number of microseconds.
-  struct timeval timer;     // Tracks timeout for retransmission
-  timer.tv_sec = -1;
-  timer.tv_usec = -1;
-  // END
+  struct timespec now;
 
-  if (argc < 6) {
-    fprintf(stderr,"usage: %s hostname port file-name N MSS\n", argv[0]);
-    exit(1);
-  }
+  if(clock_gettime(CLOCK_MONOTONIC, &now) != 0) error("ERROR: clock_gettime failed");
+  return (uint64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
 
-  //*** Init - Begin ***
+/**
+ * timerCancel - removes a timer from the timer wheel
+ * @wheel - the timer wheel
+ * @entry - the timer being cancelled
+ **/
+void timerCancel(struct timerWheel *wheel, struct timerEntry *entry)
+{
+  if(!entry->armed) return;
+  if(entry->prev) entry->prev->next = entry->next;
+  else wheel->buckets[(entry->expiry / WHEEL_TICK_USEC) & (WHEEL_SLOTS - 1)] = entry->next;
+  if(entry->next) entry->next->prev = entry->prev;
+  entry->armed = 0;
+}
 
-  host_name = argv[1];
-  portno = atoi(argv[2]);
-  file_name = argv[3];
-  winSize = atoi(argv[4]);
-  maxSegSize = atoi(argv[5]);
+/**
+ * timerArm - (re)starts a timer
+ * @wheel - the timer wheel
+ * @entry - the timer being started
+ * @expiry - the monotonic time in microseconds the timer expires at
+ *
+ * Note: A timer that has already expired is placed in the current tick's bucket so it
+ * fires on the next call to timerExpire() rather than a revolution later.
+ **/
+void timerArm(struct timerWheel *wheel, struct timerEntry *entry, uint64_t expiry)
+{
+  struct timerEntry **bucket;
+
+  timerCancel(wheel, entry);
+  if(expiry / WHEEL_TICK_USEC < wheel->curTick) expiry = wheel->curTick * WHEEL_TICK_USEC;
+  entry->expiry = expiry;
+  bucket = &wheel->buckets[(expiry / WHEEL_TICK_USEC) & (WHEEL_SLOTS - 1)];
+  entry->prev = NULL;
+  entry->next = *bucket;
+  if(*bucket) (*bucket)->prev = entry;
+  *bucket = entry;
+  entry->armed = 1;
+}
 
-  currentWin = winSize;
+/**
+ * timerExpire - advances the wheel to the current time and removes every timer that expired
+ * @wheel - the timer wheel
+ * @now - the current monotonic time in microseconds
+ * @fired - filled with the timers that expired
+ *
+ * Note: fired must have room for every armed timer (one per go back slot)
+ *
+ * Return int - the number of timers that expired
+ **/
+int timerExpire(struct timerWheel *wheel, uint64_t now, struct timerEntry **fired)
+{
+  struct timerEntry *entry, *next;
+  uint64_t nowTick = now / WHEEL_TICK_USEC, tick;
+  int numFired = 0;
+
+  // Visiting more than one revolution of buckets would only revisit the same ones
+  tick = wheel->curTick;
+  if(nowTick - tick >= WHEEL_SLOTS) tick = nowTick - WHEEL_SLOTS + 1;
+
+  for(; tick <= nowTick; tick++) {
+    for(entry = wheel->buckets[tick & (WHEEL_SLOTS - 1)]; entry != NULL; entry = next) {
+      next = entry->next;
+      if(entry->expiry <= now) {
+        timerCancel(wheel, entry);
+        fired[numFired++] = entry;
+      }
+    }
+  }
+  wheel->curTick = nowTick;
+  return numFired;
+}
 
-  if(maxSegSize >= BUFFER_SIZE) maxSegSize = BUFFER_SIZE - 8;  // Server is unaware of maxSegSize so this is a temp fix
+/**
+ * timerWait - finds how long the client can sleep before a timer may expire
+ * @wheel - the timer wheel
+ * @now - the current monotonic time in microseconds
+ *
+ * Return uint64_t - the microseconds until the first tick holding a timer, or a full
+ * revolution if the wheel is empty
+ **/
+uint64_t timerWait(struct timerWheel *wheel, uint64_t now)
+{
+  uint64_t tick = now / WHEEL_TICK_USEC;
 
-  // It appears u_char & char are of size 1B
-  sndDataSize = (sizeof(u_char)*maxSegSize) + 8;
-  fileBufferSize = sizeof(char)*maxSegSize;
+  for(int i = 0; i < WHEEL_SLOTS; i++, tick++) {
+    if(wheel->buckets[tick & (WHEEL_SLOTS - 1)] != NULL)
+      return tick * WHEEL_TICK_USEC > now ? tick * WHEEL_TICK_USEC - now : 0;
+  }
+  return WHEEL_SLOTS * WHEEL_TICK_USEC;
+}
 
-  //printf("snd: %d, file: %d\n", sndDataSize, fileBufferSize);
+/**
+ * clampRto - keeps the retransmission timeout within the bounds given on the command line
+ * @est - the round trip time estimator
+ **/
+void clampRto(struct rttEstimator *est)
+{
+  if(est->rto < est->minRto) est->rto = est->minRto;
+  if(est->rto > est->maxRto) est->rto = est->maxRto;
+}
 
-  goBackDgrams = (u_char**) malloc(winSize * sizeof(*goBackDgrams));
-  if (goBackDgrams == NULL) error("Go back step 1 memory allocation failure\n");
+/**
+ * rttReset - recomputes the retransmission timeout from the current estimate, clearing any backoff
+ * @est - the round trip time estimator
+ **/
+void rttReset(struct rttEstimator *est)
+{
+  if(est->haveSample) est->rto = est->srtt + (4 * est->rttvar > WHEEL_TICK_USEC ? 4 * est->rttvar : WHEEL_TICK_USEC);
+  else est->rto = TIMEOUT * 1000000;
+  clampRto(est);
+}
 
-  for(int i=0; i<winSize; i++) {
-    goBackDgrams[i] = (u_char*) malloc(sndDataSize);
-    if (goBackDgrams[i] == NULL) error("Go back step 2 memory allocation failure\n");
+/**
+ * rttSample - updates the estimator with a measured round trip time (Jacobson/Karels)
+ * @est - the round trip time estimator
+ * @rtt - the round trip time in microseconds of a datagram that was only sent once
+ *
+ * Note: The retransmission timeout is SRTT + max(G, 4*RTTVAR) where G is the granularity of
+ * the timer wheel
+ **/
+void rttSample(struct rttEstimator *est, uint64_t rtt)
+{
+  uint64_t delta;
+
+  if(!est->haveSample) {
+    est->srtt = rtt;
+    est->rttvar = rtt / 2;
+    est->haveSample = 1;
+  } else {
+    delta = est->srtt > rtt ? est->srtt - rtt : rtt - est->srtt;
+    est->rttvar = (3 * est->rttvar + delta) / 4;
+    est->srtt = (7 * est->srtt + rtt) / 8;
   }
+  rttReset(est);
 
-  sndDatagram = (u_char*) malloc(sndDataSize);
-  fileBuffer = (char*) malloc(fileBufferSize);
-  if (sndDatagram == NULL) error("Datagram memory allocation failure\n");
-  if (fileBuffer == NULL) error("Filebuffer memory allocation failure\n");
+#ifdef DEBUG
+  printf("rtt: %lu, srtt: %lu, rttvar: %lu, rto: %lu\n", rtt, est->srtt, est->rttvar, est->rto);
+#endif
+}
 
-  // AF_INET is for the IPv4 protocol. SOCK_STREAM represents a 
-  // Stream Socket. 0 uses system default for transportation
-  // protocol. In this case will be UDP 
-  sockfd = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
-  if (sockfd < 0) error("ERROR opening socket");
+/**
+ * rttBackoff - doubles the retransmission timeout after a timeout
+ * @est - the round trip time estimator
+ **/
+void rttBackoff(struct rttEstimator *est)
+{
+  est->rto *= 2;
+  clampRto(est);
+}
 
-  maxfd = sockfd+1;  
-  FD_ZERO(&allset);         // Initialiazes
-  FD_SET(sockfd, &allset);  // Adds socket
-  rset = allset;            // initializes read set
+/**
+ * renoAck - grows the window by one per ACK in slow start, and by one per window of ACKs after
+ * @cc - the congestion window
+ * @numAcked - the number of datagrams newly ACK'd
+ * @now - the current monotonic time in microseconds
+ * @srtt - the smoothed round trip time in microseconds
+ **/
+void renoAck(struct congestionCtl *cc, int numAcked, uint64_t now, uint64_t srtt)
+{
+  (void) now;
+  (void) srtt;
+  if(cc->cwnd < cc->ssthresh) cc->cwnd += numAcked;
+  else cc->cwnd += (double) numAcked / cc->cwnd;
+}
 
-  // Sets all variables in the server_addr struct to 0 to prevent "junk" 
-  // in the variables. "Always pass structures by reference w/ the 
-  // size of the structure." 
-  memset((char *) &server_addr, 0, sizeof(server_addr));
+/**
+ * renoLoss - halves the window
+ * @cc - the congestion window
+ **/
+void renoLoss(struct congestionCtl *cc)
+{
+  cc->ssthresh = cc->cwnd / 2 > MIN_CWND ? cc->cwnd / 2 : MIN_CWND;
+  cc->cwnd = cc->ssthresh;
+}
 
-  server_addr.sin_family = AF_INET;					// Internet Address Family 
-  server_addr.sin_port = htons(portno);		  // Port Number in Network Byte Order 
+/**
+ * cubicAck - grows the window along W(t) = C(t - K)^3 + wMax, where t is the time since the
+ * window began growing again, so it climbs fast while far below the window of the last loss,
+ * flattens out near it and probes beyond it (RFC 8312). Slow start is the same as Reno's.
+ * @cc - the congestion window
+ * @numAcked - the number of datagrams newly ACK'd
+ * @now - the current monotonic time in microseconds
+ * @srtt - the smoothed round trip time in microseconds
+ *
+ * Note: the window never grows slower than Reno's would, which on a short RTT path is the faster
+ **/
+void cubicAck(struct congestionCtl *cc, int numAcked, uint64_t now, uint64_t srtt)
+{
+  double t, target;
 
-  clientLen = sizeof(server_addr);
+  if(cc->cwnd < cc->ssthresh) {
+    cc->cwnd += numAcked;
+    return;
+  }
+  if(cc->epochStart == 0) {
+    cc->epochStart = now;
+    if(cc->cwnd < cc->wMax) cc->k = cbrt((cc->wMax - cc->cwnd) / CUBIC_C);
+    else {
+      cc->k = 0;
+      cc->wMax = cc->cwnd;
+    }
+    cc->renoWin = cc->cwnd;
+  }
 
-  // Retrieves the host information based on the address
-  // passed from the users commandline. 
-  server = gethostbyname(argv[1]);
-  if (server == NULL) error("ERROR, no such host");
+  // The window one RTT from now
+  t = (now - cc->epochStart + srtt) / 1e6;
+  target = CUBIC_C * (t - cc->k) * (t - cc->k) * (t - cc->k) + cc->wMax;
+  if(target > 1.5 * cc->cwnd) target = 1.5 * cc->cwnd;
+  cc->renoWin += 3 * (1 - CUBIC_BETA) / (1 + CUBIC_BETA) * numAcked / cc->cwnd;
+  if(target < cc->renoWin) target = cc->renoWin;
 
-  // Copies the server info into the the appropriate socket struct. 
-  bcopy((char *) server->h_addr, (char *) &server_addr.sin_addr.s_addr, server->h_length);
+  if(target > cc->cwnd) cc->cwnd += (target - cc->cwnd) * numAcked / cc->cwnd;
+  else cc->cwnd += 0.01 * numAcked / cc->cwnd;
+}
+
+/**
+ * cubicLoss - cuts the window to CUBIC_BETA of itself and starts a new epoch. A window cut
+ * again before it is back at the last loss's releases more, making room for newer streams.
+ * @cc - the congestion window
+ **/
+void cubicLoss(struct congestionCtl *cc)
+{
+  if(cc->cwnd < cc->wMax) cc->wMax = cc->cwnd * (1 + CUBIC_BETA) / 2;
+  else cc->wMax = cc->cwnd;
+  cc->ssthresh = cc->cwnd * CUBIC_BETA > MIN_CWND ? cc->cwnd * CUBIC_BETA : MIN_CWND;
+  cc->cwnd = cc->ssthresh;
+  cc->epochStart = 0;
+}
+
+/**
+ * slowStartTimeout - restarts slow start from one datagram, the path may have no room at all
+ * @cc - the congestion window
+ **/
+void slowStartTimeout(struct congestionCtl *cc)
+{
+  cc->cwnd = 1;
+}
+
+/**
+ * fixedAck - keeps the window at N, as before there was congestion control
+ * @cc - the congestion window
+ * @numAcked - the number of datagrams newly ACK'd
+ * @now - the current monotonic time in microseconds
+ * @srtt - the smoothed round trip time in microseconds
+ **/
+void fixedAck(struct congestionCtl *cc, int numAcked, uint64_t now, uint64_t srtt)
+{
+  (void) numAcked;
+  (void) now;
+  (void) srtt;
+  cc->cwnd = cc->cap;
+}
+
+/**
+ * fixedLoss - leaves the window at N
+ * @cc - the congestion window
+ **/
+void fixedLoss(struct congestionCtl *cc)
+{
+  cc->cwnd = cc->cap;
+}
+
+const struct ccAlgo ccAlgos[] = {
+  { "reno", INIT_CWND, renoAck, renoLoss, slowStartTimeout },
+  { "cubic", INIT_CWND, cubicAck, cubicLoss, slowStartTimeout },
+  { "fixed", 0, fixedAck, fixedLoss, fixedLoss },
+};
+
+#define NUM_CC_ALGOS (sizeof(ccAlgos) / sizeof(ccAlgos[0]))
+
+const struct ccAlgo *congestionAlgo = &ccAlgos[0];    // The congestion control every stream uses, set by main
+
+/**
+ * ccFind - finds a congestion control strategy by name
+ * @name - "reno", "cubic" or "fixed"
+ *
+ * Return const struct ccAlgo* - the strategy, NULL if there is none by that name
+ **/
+const struct ccAlgo *ccFind(const char *name)
+{
+  for(unsigned i = 0; i < NUM_CC_ALGOS; i++)
+    if(strcmp(ccAlgos[i].name, name) == 0) return &ccAlgos[i];
+  return NULL;
+}
+
+/**
+ * ccInit - starts a stream's congestion window in slow start
+ * @cc - the congestion window
+ * @cap - N, the most the window grows to
+ **/
+void ccInit(struct congestionCtl *cc, int cap)
+{
+  memset(cc, 0, sizeof(*cc));
+  cc->algo = congestionAlgo;
+  cc->cap = cap;
+  cc->ssthresh = cap;
+  cc->cwnd = cc->algo->initWin > 0 && cc->algo->initWin < cap ? cc->algo->initWin : cap;
+  cc->maxCwnd = cc->cwnd;
+}
+
+/**
+ * ccWindow - the number of datagrams the stream may have in flight
+ * @cc - the congestion window
+ *
+ * Return int - the congestion window in whole datagrams, at least 1 and at most N
+ **/
+int ccWindow(struct congestionCtl *cc)
+{
+  int win = (int) cc->cwnd;
+
+  if(win < 1) return 1;
+  return win > cc->cap ? cc->cap : win;
+}
+
+/**
+ * sendWindow - the number of datagrams the stream may have in flight, the congestion window
+ * held to the receive window the server last advertised
+ * @cc - the congestion window
+ * @peerWin - the server's receive window. At 0 one datagram is still sent, to learn when it opens
+ *
+ * Return int - the datagrams, at least 1 and at most N
+ **/
+int sendWindow(struct congestionCtl *cc, uint32_t peerWin)
+{
+  int win = ccWindow(cc);
+
+  if(peerWin == 0) return 1;
+  return peerWin < (uint32_t) win ? (int) peerWin : win;
+}
+
+/**
+ * ccAck - grows the window for datagrams newly ACK'd
+ * @cc - the congestion window
+ * @numAcked - the number of datagrams newly ACK'd
+ * @now - the current monotonic time in microseconds
+ * @srtt - the smoothed round trip time in microseconds
+ **/
+void ccAck(struct congestionCtl *cc, int numAcked, uint64_t now, uint64_t srtt)
+{
+  cc->algo->onAck(cc, numAcked, now, srtt);
+  if(cc->cwnd > cc->cap) cc->cwnd = cc->cap;
+  if(cc->cwnd > cc->maxCwnd) cc->maxCwnd = cc->cwnd;
+}
+
+/**
+ * ccLoss - cuts the window after duplicate ACKs show a datagram was lost
+ * @cc - the congestion window
+ * @sentAt - the monotonic time in microseconds the lost datagram was first sent
+ * @now - the current monotonic time in microseconds
+ *
+ * Note: the window is cut once per episode, losses of datagrams sent before the last cut are
+ * from the window that was already cut for
+ **/
+void ccLoss(struct congestionCtl *cc, uint64_t sentAt, uint64_t now)
+{
+  if(sentAt < cc->lastCut) return;
+  cc->algo->onLoss(cc);
+  cc->lastCut = now;
+  cc->losses++;
+
+#ifdef DEBUG
+  printf("Loss: cwnd: %.1f, ssthresh: %.1f\n", cc->cwnd, cc->ssthresh);
+#endif
+}
+
+/**
+ * ccTimeout - cuts the window after a retransmission timeout
+ * @cc - the congestion window
+ * @sentAt - the monotonic time in microseconds the timed out datagram was first sent
+ * @now - the current monotonic time in microseconds
+ *
+ * Note: ssthresh is only lowered if the loss is a new episode, a timeout while already
+ * recovering from one shouldn't halve it again
+ **/
+void ccTimeout(struct congestionCtl *cc, uint64_t sentAt, uint64_t now)
+{
+  if(sentAt >= cc->lastCut) cc->algo->onLoss(cc);
+  cc->algo->onTimeout(cc);
+  cc->lastCut = now;
+  cc->timeouts++;
+
+#ifdef DEBUG
+  printf("Timeout: cwnd: %.1f, ssthresh: %.1f\n", cc->cwnd, cc->ssthresh);
+#endif
+}
+
+/**
+ * pacerRate - sets the pacing rate from the congestion window and the smoothed RTT, so a
+ * window is spread over a little less than a round trip
+ * @p - the pacer
+ * @cc - the congestion window
+ * @est - the round trip time estimator
+ * @dgramLen - the length of a full datagram
+ *
+ * Note: until an RTT has been measured the stream is only paced by the cap, if there is one
+ **/
+void pacerRate(struct pacer *p, struct congestionCtl *cc, struct rttEstimator *est, size_t dgramLen)
+{
+  double rate = 0;
+
+  if(est->haveSample && est->srtt > 0)
+    rate = (cc->cwnd < cc->ssthresh ? PACING_SS_GAIN : PACING_CA_GAIN) * cc->cwnd * dgramLen * 1e6 / est->srtt;
+  if(maxPacingRate > 0 && (rate == 0 || rate > maxPacingRate)) rate = maxPacingRate;
+
+  p->rate = rate;
+  p->depth = rate * PACING_BURST_USEC / 1e6;
+  if(p->depth < PACING_BURST_DGRAMS * dgramLen) p->depth = PACING_BURST_DGRAMS * dgramLen;
+}
+
+/**
+ * pacerReady - adds the tokens earned since the last call and checks if a datagram may be sent
+ * @p - the pacer
+ * @now - the current monotonic time in microseconds
+ *
+ * Return int - 1 if a datagram may be sent now, 0 otherwise
+ **/
+int pacerReady(struct pacer *p, uint64_t now)
+{
+  if(p->rate == 0) return 1;
+  if(now > p->last) p->tokens += p->rate * (now - p->last) / 1e6;
+  if(p->tokens > p->depth) p->tokens = p->depth;
+  p->last = now;
+  return p->tokens > 0;
+}
+
+/**
+ * pacerSpend - takes the tokens for a datagram queued to be sent
+ * @p - the pacer
+ * @len - the length of the datagram
+ **/
+void pacerSpend(struct pacer *p, size_t len)
+{
+  if(p->rate > 0) p->tokens -= len;
+}
+
+/**
+ * pacerWait - the time until the pacer lets the next datagram be sent
+ * @p - the pacer
+ *
+ * Return uint64_t - microseconds, 0 if a datagram may be sent now
+ **/
+uint64_t pacerWait(struct pacer *p)
+{
+  if(p->rate == 0 || p->tokens > 0) return 0;
+  return (uint64_t)(-p->tokens * 1e6 / p->rate) + 1;
+}
+
+/**
+ * areThereACKs - polls to see if there are ACKs that have been received
+ * @maxfd - the maximum file descriptor size in rset
+ * @allset - all possible file descriptors for reading & writing
+ * @rset - the set of file descriptors to be checked for possible ACKs
+ * @timeout - how long select should poll for ACKS - 0 == none blocking
+ *
+ * Return - The number for file descriptors ready for reading
+ **/
+int areThereACKs(int maxfd, fd_set *allset, fd_set *rset, struct timeval *timeout)
+{
+  int nready;
+
+  *rset = *allset;    // needs to be reset each time
+  nready = select( maxfd, rset, NULL, NULL,  timeout);
+  if(nready < 0) error("ERROR: select failed");
+  return nready;
+}
+
+/**
+ * ringInit - allocates the send ring
+ * @ring - the send ring
+ * @numSlots - the number of datagrams the ring holds (the window size)
+ * @maxDgramLen - the largest datagram stored, header included
+ **/
+void ringInit(struct sendRing *ring, int numSlots, size_t maxDgramLen)
+{
+  ring->stride = (maxDgramLen + SLOT_ALIGN - 1) & ~(size_t)(SLOT_ALIGN - 1);
+  ring->numSlots = numSlots;
+  ring->slots = (u_char*) aligned_alloc(SLOT_ALIGN, ring->stride * numSlots);
+  if (ring->slots == NULL) error("Send ring memory allocation failure\n");
+}
+
+/**
+ * ringSlot - finds a slot of the send ring
+ * @ring - the send ring
+ * @slot - the index of the slot
+ *
+ * Return u_char* - the start of the datagram stored in the slot
+ **/
+u_char *ringSlot(struct sendRing *ring, int slot)
+{
+  return ring->slots + ring->stride * slot;
+}
+
+/**
+ * markSelectiveACK - marks the datagram individually ACK'd by the server and slides the window
+ * base past the ACK'd datagrams at its front
+ * @goBackInfo - the bookkeeping for the saved datagrams
+ * @ackdSeqNum - the sequence # received in the ACK
+ * @winBase - the slot of the earliest datagram that has yet to be ACK'd
+ * @numInFlight - the number of saved datagrams that have yet to be ACK'd
+ * @winSize - the number of buffers saved before being replaced
+ * @wheel - the timer wheel holding the datagrams' retransmission timers
+ * @rtt - the round trip time estimator, sampled if the datagram was only sent once. NULL if
+ * the ACK can't be timed, because it only reports the datagram along with another
+ *
+ * Note: An ACK for a resent datagram can't be timed, but it still shows the path is delivering
+ * again, so it clears the backoff. Otherwise a lossy window would back off without end.
+ *
+ * Return int - the number of slots freed, -1 if the ACK was not for a datagram in flight or
+ * the datagram was already ACK'd
+ **/
+int markSelectiveACK(struct dgramInfo *goBackInfo, uint32_t ackdSeqNum, int *winBase, int numInFlight, int winSize,
+    struct timerWheel *wheel, struct rttEstimator *rtt)
+{
+  uint32_t dist;
+  int freed = 0, slot;
+
+  if(numInFlight == 0) return -1;
+
+  dist = seqDist(goBackInfo[*winBase].seq, ackdSeqNum);
+  if(dist >= (uint32_t)numInFlight) return -1;    // A duplicate for a slot already freed
+  slot = (*winBase + dist) % winSize;
+  if(goBackInfo[slot].acked) return -1;
+  if(rtt != NULL) {
+    if(goBackInfo[slot].retransmitted) rttReset(rtt);
+    else rttSample(rtt, monotonicUsec() - goBackInfo[slot].sentAt);
+  }
+  goBackInfo[slot].acked = 1;
+  timerCancel(wheel, &goBackInfo[slot].timer);
+
+#ifdef DEBUG
+  printf("Seq # %u has been selectively acknowledged\n\n", ackdSeqNum);
+#endif
+
+  while(freed < numInFlight && goBackInfo[*winBase].acked) {
+    goBackInfo[*winBase].acked = 0;
+    *winBase = (*winBase + 1) % winSize;
+    freed++;
+  }
+  return freed;
+}
+
+/**
+ * markSackInfo - selective repeat: marks what a versioned ACK says the server holds besides the
+ * datagram it ACKs, every datagram before its cumulative ACK and each one in its SACK bitmap,
+ * so a lost ACK doesn't leave a datagram the server has to be resent
+ * @goBackInfo - the bookkeeping for the saved datagrams
+ * @ack - the ACK
+ * @winBase - the slot of the earliest datagram that has yet to be ACK'd
+ * @numInFlight - the number of saved datagrams that have yet to be ACK'd
+ * @winSize - the number of buffers saved before being replaced
+ * @wheel - the timer wheel holding the datagrams' retransmission timers
+ * @numAcked - incremented for each datagram newly ACK'd
+ *
+ * Return int - the number of slots freed
+ **/
+int markSackInfo(struct dgramInfo *goBackInfo, struct ackInfo *ack, int *winBase, int numInFlight, int winSize,
+    struct timerWheel *wheel, int *numAcked)
+{
+  int freed = 0, numFreed;
+  uint64_t bits = ack->sack;
+
+  // A cumulative ACK more than a window ahead is stale or from a different stream
+  while(freed < numInFlight && goBackInfo[*winBase].seq != ack->cumAck &&
+      seqDist(goBackInfo[*winBase].seq, ack->cumAck) <= (uint32_t)(numInFlight - freed)) {
+    numFreed = markSelectiveACK(goBackInfo, goBackInfo[*winBase].seq, winBase, numInFlight - freed, winSize, wheel, NULL);
+    if(numFreed < 0) break;
+    freed += numFreed;
+    (*numAcked)++;
+  }
 
-  fileToTransfer = fopen(argv[3], "r");
-  if(fileToTransfer == NULL) error("Error opening the file to tranfer");
+  for(int bit; bits != 0; bits &= bits - 1) {
+    bit = __builtin_ctzll(bits);
+    numFreed = markSelectiveACK(goBackInfo, ack->cumAck + 1 + bit, winBase, numInFlight - freed, winSize,
+        wheel, NULL);
+    if(numFreed < 0) continue;
+    freed += numFreed;
+    (*numAcked)++;
+  }
+  return freed;
+}
+
+/**
+ * resendDgram - queues a single saved datagram to be resent straight from its send ring slot
+ * and, when the file is mapped, from the file's pages
+ * @ring - the send ring holding the datagram
+ * @goBackInfo - the bookkeeping for the saved datagrams
+ * @slot - the slot of the datagram to be resent
+ * @batch - the batch the datagram is queued in
+ * @sockfd - the socket file descriptor
+ * @server_addr - the server socket information
+ * @reason - why the datagram is resent, printed with its sequence #
+ *
+ * Note: exactly the bytes originally sent are resent, using the length stored for the slot
+ **/
+void resendDgram(struct sendRing *ring, struct dgramInfo *goBackInfo, int slot, struct sendBatch *batch, int *sockfd,
+    struct sockaddr_in *server_addr, const char *reason)
+{
+  batchAdd(batch, sockfd, server_addr, ringSlot(ring, slot), goBackInfo[slot].data, goBackInfo[slot].len - headerLen);  
+  goBackInfo[slot].retransmitted = 1;
+
+  printf("%s, sequence number = %u\n", reason, goBackInfo[slot].seq);
+}
+
+/**
+ * fastRetransmit - marks the datagrams the server is missing to be resent once DUP_ACK_THRESH
+ * duplicate ACKs arrive, instead of waiting for their timers
+ * @goBackInfo - the bookkeeping for the saved datagrams
+ * @winBase - the slot of the earliest datagram that has yet to be ACK'd
+ * @numInFlight - the number of saved datagrams that have yet to be ACK'd
+ * @winSize - the number of buffers saved before being replaced
+ * @wheel - the timer wheel holding the datagrams' retransmission timers
+ *
+ * Note: A Go-Back-N server discarded every datagram after the missing one, so the whole
+ * window is resent. A selective repeat server buffered them, so only the earliest is resent.
+ * A datagram is marked by cancelling its timer, the same as one that timed out, and is resent
+ * by the paced resend pass of the send loop.
+ **/
+void fastRetransmit(struct dgramInfo *goBackInfo, int winBase, int numInFlight, int winSize, struct timerWheel *wheel)
+{
+  int numToResend = transferMode == MODE_SR ? 1 : numInFlight;
+
+  for(int i = 0; i < numToResend; i++) timerCancel(wheel, &goBackInfo[(winBase + i) % winSize].timer);
+}
+
+/**
+ * probeMss - finds the largest datagram the path to the server carries, up to the MSS agreed,
+ * by sending padded probes the server answers (packetization layer PMTU discovery, RFC 8899).
+ * Each round sends one probe of the agreed size and one of each probeMtus size below it, all
+ * with DF set, and waits PROBE_TIMEOUT_MSEC for the answers. Rounds are sent until the
+ * largest probe is answered or PROBE_TRIES have been.
+ * @st: The stream, connected with an agreed MSS and DF set
+ *
+ * Note: DF stays set for the transfer, so a datagram is never fragmented. A probe larger
+ *   than the interface's MTU fails at once with EMSGSIZE, one lost further along the path
+ *   (where the ICMP error is ignored) simply goes unanswered.
+ *
+ * Return size_t - the largest segment the path carries, the agreed MSS if no probe is answered
+ * and it fits the IPv6 minimum MTU, the IPv6 minimum otherwise
+ **/
+size_t probeMss(struct stream *st)
+{
+  size_t sizes[NUM_PROBE_MTUS + 1], best = 0, numSizes = 0;
+  u_char *probe, answer[ACK_BUFFER_SIZE];
+  ssize_t recsize;
+  uint32_t len;
+  uint16_t chkRecvd;
+  uint64_t deadline, now;
+  fd_set rset;
+  struct timeval timeout;
+
+  sizes[numSizes++] = st->maxSegSize + headerLen;
+  for(size_t i = 0; i < NUM_PROBE_MTUS; i++)
+    if(probeMtus[i] - IP_UDP_HDR_LEN < (int) sizes[0]) sizes[numSizes++] = probeMtus[i] - IP_UDP_HDR_LEN;
+
+  probe = (u_char*) calloc(1, sizes[0]);
+  if(probe == NULL) error("Probe memory allocation failure\n");
+  probe[6] = probeFlag >> 8;
+  probe[7] = probeFlag & 0xFF;
+
+  for(int i = 0; i < PROBE_TRIES && best < sizes[0]; i++) {
+    for(size_t p = 0; p < numSizes && sizes[p] > best; p++) {
+      probe[0] = sizes[p] >> 24;
+      probe[1] = sizes[p] >> 16;
+      probe[2] = sizes[p] >> 8;
+      probe[3] = sizes[p];
+      probe[4] = probe[5] = 0;
+      addNewChksum(probe, calcChecksum(probe, sizes[p], 0));
+      if(sendto(st->sockfd, probe, sizes[p], 0, (struct sockaddr*) &st->server_addr, sizeof(st->server_addr)) < 0 &&
+          errno != EMSGSIZE) error("Error sending the packet:");
+    }
+
+    deadline = monotonicUsec() + PROBE_TIMEOUT_MSEC * 1000;
+    while(best < sizes[0] && (now = monotonicUsec()) < deadline) {
+      timeout.tv_sec = 0;
+      timeout.tv_usec = deadline - now;
+      FD_ZERO(&rset);
+      FD_SET(st->sockfd, &rset);
+      if(select(st->sockfd+1, &rset, NULL, NULL, &timeout) <= 0) break;
+
+      recsize = recv(st->sockfd, answer, sizeof(answer), 0);
+      if(recsize < 8 || ((answer[6] << 8) | answer[7]) != probeAckFlag) continue;
+      chkRecvd = (answer[4] << 8) | answer[5];
+      answer[4] = answer[5] = 0;
+      if(calcChecksum(answer, recsize, 0) != chkRecvd) continue;
+      len = getWord(answer);
+      for(size_t p = 0; p < numSizes; p++) if(sizes[p] == len && len > best) best = len;
+    }
+  }
+  free(probe);
+
+  if(best == 0) best = sizes[0] + IP_UDP_HDR_LEN <= 1280 ? sizes[0] : 1280 - IP_UDP_HDR_LEN;
+  printf("Client: the path carries datagrams of %lu bytes, segments of %lu bytes\n", best, best - headerLen);
+  return best - headerLen;
+}
+
+/**
+ * streamConnect - opens a stream's socket and does its handshake
+ * @st: The stream
+ *
+ * Note: the agreed transfer mode and connection ID are set in the calling thread's stream state.
+ *   The first stream finds the largest segment the path carries, the other streams ask for it.
+ **/
+void streamConnect(struct stream *st)
+{
+  int mssAgreed = 0;
+
+  // AF_INET is for the IPv4 protocol. SOCK_STREAM represents a 
+  // Stream Socket. 0 uses system default for transportation
+  // protocol. In this case will be UDP 
+  st->sockfd = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+  if (st->sockfd < 0) error("ERROR opening socket");
+
+  // A kernel without UDP_SEGMENT rejects the option, the datagrams are then sent one per message
+  if(st->gso && setsockopt(st->sockfd, SOL_UDP, UDP_SEGMENT, &(int){0}, sizeof(int)) < 0) {
+    if(st->index == 0) printf("Segmentation offload is not supported, sending datagrams individually\n");
+    st->gso = 0;
+  }
+
+  transferMode = negotiateMode(st, selectiveRepeat ? MODE_SR : MODE_GBN, uploadName, st->index == 0 ? 0 : firstConnId,
+      &mssAgreed);
+
+  if(!mssAgreed && st->maxSegSize > BUFFER_SIZE - headerLen) st->maxSegSize = BUFFER_SIZE - headerLen;  // Only an MSS agreed may be larger
+  if(!mssAgreed) return;
+
+  // Every stream sends with DF set once an MSS is agreed. The first stream probes the path, the
+  // others ask for the MSS it found in their SYN, so the server agrees the same one for them.
+  setsockopt(st->sockfd, IPPROTO_IP, IP_MTU_DISCOVER, &(int){IP_PMTUDISC_PROBE}, sizeof(int));
+  if(st->index == 0) st->maxSegSize = probeMss(st);
+}
+
+/**
+ * closeConnection - closes the connection to the server with a close carrying the number of
+ * bytes the stream sent. The server ACKs it once every byte has arrived, and it is resent each
+ * retransmission timeout, doubled each time, until the FIN ACK comes or FIN_TRIES were sent.
+ * When the server agreed to check the stream's hash it follows the length, and the FIN ACK
+ * says if the server's copy matched. A mismatch sets hashMismatch.
+ * @sockfd: The file descriptor for the socket
+ * @server_addr: Contains the info for the server
+ * @length: The number of bytes the stream sent
+ * @rtt: The stream's round trip time estimator, which sets how long each close waits
+ *
+ * Note: A server that didn't agree an initial sequence # doesn't ACK the close, it is sent once
+ **/
+void closeConnection(int *sockfd, struct sockaddr_in *server_addr, uint64_t length, struct rttEstimator *rtt)
+{
+  u_char sndDatagram[CONN_HDR_LEN + 16], recvdDatagram[ACK_BUFFER_SIZE];
+  size_t finLen = headerLen + (hashing ? 16 : 8);
+  ssize_t recsize;
+  uint64_t deadline, now;
+  uint16_t chkRecvd;
+  fd_set rset;
+  struct timeval timeout;
+
+  printf("Client: closing connection\n");
+	
+  sndDatagram[0] = sequenceNumber >> 24;
+  sndDatagram[1] = sequenceNumber >> 16;
+  sndDatagram[2] = sequenceNumber >> 8;
+  sndDatagram[3] = sequenceNumber;
+  sndDatagram[4] = pseudoChksum >> 8;
+  sndDatagram[5] = pseudoChksum;
+  sndDatagram[6] = closeFlag >> 8;
+  sndDatagram[7] = closeFlag & 0xFF;
+  // With a connection ID the server finds the session by it
+  if(connId != 0) {
+    sndDatagram[6] = connCloseFlag >> 8;
+    sndDatagram[7] = connCloseFlag & 0xFF;
+    sndDatagram[8] = connId >> 24;
+    sndDatagram[9] = connId >> 16;
+    sndDatagram[10] = connId >> 8;
+    sndDatagram[11] = connId;
+  }
+  for(int i = 0; i < 8; i++) sndDatagram[headerLen + i] = length >> (56 - 8*i);
+  for(int i = 0; hashing && i < 8; i++) sndDatagram[headerLen + 8 + i] = fileHash >> (56 - 8*i);
+  addNewChksum(sndDatagram, calcChecksum(sndDatagram, finLen, 0));
+
+  for(int i = 0; i < (finAcked ? FIN_TRIES : 1); i++) {
+    sendDatagram(sockfd, server_addr, sndDatagram, finLen);
+    if(!finAcked) return;
+
+    // ACKs of the data still arriving are skipped
+    deadline = monotonicUsec() + rtt->rto;
+    while((now = monotonicUsec()) < deadline) {
+      timeout.tv_sec = (deadline - now) / 1000000;
+      timeout.tv_usec = (deadline - now) % 1000000;
+      FD_ZERO(&rset);
+      FD_SET(*sockfd, &rset);
+      if(select(*sockfd+1, &rset, NULL, NULL, &timeout) <= 0) break;
+
+      recsize = recv(*sockfd, recvdDatagram, sizeof(recvdDatagram), 0);
+      if(recsize < 8 || ((recvdDatagram[6] << 8) | recvdDatagram[7]) != finAckFlag || getWord(recvdDatagram) != sequenceNumber)
+        continue;
+      chkRecvd = (recvdDatagram[4] << 8) | recvdDatagram[5];
+      recvdDatagram[4] = pseudoChksum >> 8;
+      recvdDatagram[5] = pseudoChksum;
+      if(calcChecksum(recvdDatagram, recsize, 0) != chkRecvd) continue;
+
+      // A FIN ACK resent after the session ended no longer knows the verdict
+      if(hashing && recsize > 8 && recvdDatagram[8] == 1) printf("Client: the server's copy matches the hash\n");
+      else if(hashing && recsize > 8) {
+        fprintf(stderr, "Client: the server's copy DOES NOT match the hash\n");
+        hashMismatch = 1;
+      } else if(hashing) printf("Client: the server closed before saying if its copy matches the hash\n");
+      return;
+    }
+    rttBackoff(rtt);
+  }
+  printf("Client: the server did not ACK the close\n");
+}
+
+/**
+ * streamSend - sends a stream's byte range of the file and closes the stream
+ * @st: The stream, connected by streamConnect() in the calling thread
+ **/
+void streamSend(struct stream *st)
+{
+	// The socket file descriptor, port number, and the number of chars read/written
+  int sockfd = st->sockfd, winSize = st->winSize, currentWin, goBackDgramPtr = 0, noMoreData = 0;
+  int winBase = 0, numFreed, numFired, lastSlot, numDupAcks = 0, numAcks, numAcked, numSacked;
+  int receiverBusy = 0;                       // The server's disk is falling behind, one datagram is kept in flight
+  int resendPending = 0, canSend;             // If datagrams without a running timer are waiting to be resent
+  const char *resendReason = "Timeout";       // Why they are resent
+  size_t maxSegSize = st->maxSegSize, numRead = 0;
+  u_char *sndDatagram;      // The send ring slot each new datagram is built in
+  struct sockaddr_in server_addr = st->server_addr; // Sockadder_in struct that stores the IP address, port, and etc of the server.
+  struct sendRing goBackDgrams;               // The datagrams that have yet to be ACK'd
+  struct dgramInfo *goBackInfo;               // The sequence #, ACK state and timer of each saved datagram
+  struct timerWheel wheel = {0};              // The retransmission timers of the datagrams in flight
+  struct timerEntry **firedTimers;            // The timers that expired on each pass of the timer wheel
+  struct rttEstimator rtt = st->rtt;          // Derives the retransmission timeout from measured RTTs
+  struct congestionCtl cc;                    // How many of the N slots may be in flight
+  struct pacer pacer = {0};                   // When the next datagram may be sent
+  uint64_t now, waitUsec;
+  uint16_t dataChk;                           // The checksum of each segment's data, computed as it is read
+  const u_char *dgramData;                    // Where each segment's data is, in the mapped file or its slot
+  uint32_t lastSeqACKd = sequenceNumber - 1, acksSeq;  // The sequence # before the first, what the server ACKs before it has data
+  uint64_t bytesSent = 0;                     // The bytes of the stream's range sent so far
+  struct ackInfo acks[ACK_BATCH];             // The ACKs taken from each recvmmsg call
+  uint32_t peerWin = st->winSize;             // The receive window the server last advertised
+  unsigned long numBadAcks = 0;               // ACKs that failed their checksum
+  unsigned long numResent = 0;                // Datagrams resent, after a timeout or a fast retransmit
+  struct sendBatch batch = {0};               // Datagrams waiting for the next sendmmsg call
+
+  // START select() - Used by select() to poll if there are ACKs to be read
+  fd_set rset;              // File descriptors that might be ready to read
+  fd_set allset;            // Set of all file descriptors
+  int maxfd;                // Max file descriptor of sets (will need to be incremented by 1)
+  struct timeval timeout;   // Specifies how long select should wait. 0 for both elements == no block
+  timeout.tv_sec = 0;       // Represents the number of whole seconds of elapsed time
+  timeout.tv_usec = 0;      // The rest of the elapsed time (a fraction of a second), represented as the number of microseconds.
+  // END
+
+  //*** Init - Begin ***
+
+  fileToTransfer = st->reader;
+  impairInit(&ackImpair, &ackImpairCfg, st->index);
+  if(resumeAt > 0) {
+    printf("Client: stream %d resuming after the %lu bytes the server has\n", st->index, (unsigned long) resumeAt);
+    skipFile(resumeAt);
+  }
+  batch.gso = st->gso;
+  currentWin = winSize;
+  ccInit(&cc, winSize);
+
+  // With the fq qdisc the kernel also holds the socket to the cap, within each segmentation offload send too
+  if(maxPacingRate > 0)
+    setsockopt(sockfd, SOL_SOCKET, SO_MAX_PACING_RATE, &(unsigned int){maxPacingRate < UINT_MAX ? maxPacingRate : UINT_MAX},
+        sizeof(unsigned int));
+
+  maxfd = sockfd+1;  
+  FD_ZERO(&allset);         // Initialiazes
+  FD_SET(sockfd, &allset);  // Adds socket
+  rset = allset;            // initializes read set
+
+  // The slots of a mapped file only hold headers, its data is sent and resent from its pages
+  ringInit(&goBackDgrams, winSize, fileToTransfer.mapped ? headerLen : maxSegSize + headerLen);
+  goBackInfo = (struct dgramInfo*) calloc(winSize, sizeof(*goBackInfo));
+  if (goBackInfo == NULL) error("Go back info memory allocation failure\n");
+  firedTimers = (struct timerEntry**) malloc(winSize * sizeof(*firedTimers));
+  if (firedTimers == NULL) error("Timer memory allocation failure\n");
+  wheel.curTick = monotonicUsec() / WHEEL_TICK_USEC;
 
   //*** Init - End ***
 
   //*** The client processes are ready to begin ***
 
   while(1) {
-    if(noMoreData && lastSeqACKd == lastSeqSent) {
+    if(noMoreData && currentWin == winSize) {
 
 #ifdef DEBUG
       printf("There is no more data to send\n");
@@ -505,64 +1911,307 @@ int main(int argc, char *argv[])
 
       break;
     }
-    if(hasTimerExpired(&timer)) {
-      //printf("Timer expired\n");
-      resendDgrams(goBackDgrams, &sockfd, &server_addr, maxSegSize, goBackDgramPtr, sndDataSize, winSize, totalNumDgramsSent);
-      startTimer(&timer);
+    // Only the datagrams whose own timer expired are resent. They are resent in sequence order,
+    // since the server discards a datagram that arrives ahead of one it is missing.
+    now = monotonicUsec();
+    numFired = timerExpire(&wheel, now, firedTimers);
+    if(numFired > 0 && !goBackInfo[winBase].timer.armed) {    // Once per loss, when the oldest datagram times out
+      rttBackoff(&rtt);
+      ccTimeout(&cc, goBackInfo[winBase].sentAt, now);
+    }
+    if(numFired > 0) {
+      resendPending = 1;
+      resendReason = "Timeout";
+    }
+    pacerRate(&pacer, &cc, &rtt, maxSegSize + headerLen);
+
+    // The resends are paced like new datagrams, what the pacer holds back is resent on a later pass
+    if(resendPending) {
+      resendPending = 0;
+      for(int i = 0, slot = winBase; i < winSize - currentWin; i++, slot = (slot + 1) % winSize) {
+        if(goBackInfo[slot].timer.armed || goBackInfo[slot].acked) continue;
+        if(!pacerReady(&pacer, now)) {
+          resendPending = 1;
+          break;
+        }
+        resendDgram(&goBackDgrams, goBackInfo, slot, &batch, &sockfd, &server_addr, resendReason);
+        numResent++;
+        pacerSpend(&pacer, goBackInfo[slot].len);
+        timerArm(&wheel, &goBackInfo[slot].timer, now + rtt.rto);
+      }
     }
-    while(areThereACKs(maxfd, &allset, &rset, &timeout)) {
-      acksSeq = getAck(&sockfd, &server_addr, &clientLen);
-
-      if(verifyACK(lastSeqACKd, acksSeq)) {
-        currentWin++;
-        lastSeqACKd = acksSeq;
-        startTimer(&timer);
-      } 
+    batchFlush(&batch, &sockfd);
+
+    // Sleep until an ACK arrives or a timer may expire when no datagram can be sent, or until
+    // the pacer lets the next one go
+    canSend = resendPending || (winSize - currentWin < sendWindow(&cc, peerWin) && noMoreData == 0 &&
+        !(receiverBusy && currentWin < winSize));
+    waitUsec = timerWait(&wheel, now);
+    if(canSend && pacerWait(&pacer) < waitUsec) waitUsec = pacerWait(&pacer);
+    timeout.tv_sec = waitUsec / 1000000;
+    timeout.tv_usec = waitUsec % 1000000;
+    numAcks = areThereACKs(maxfd, &allset, &rset, &timeout) ? getAcks(&sockfd, acks, &receiverBusy) : 0;
+    for(int a = 0; a < numAcks; a++) {
+      acksSeq = acks[a].seq;
+      if(acks[a].ext) peerWin = acks[a].rwnd;
+
+      // A datagram that isn't a valid ACK changes nothing
+      // Selective repeat: an ACK beyond a missing datagram counts as a duplicate of the last ACK
+      if(acks[a].status != ACK_VALID) {
+        numFreed = -1;
+        if(acks[a].status == ACK_BAD_CHKSUM) numBadAcks++;
+      } else if(transferMode == MODE_SR) {
+        numFreed = markSelectiveACK(goBackInfo, acksSeq, &winBase, winSize - currentWin, winSize, &wheel, &rtt);
+      } else {
+        numFreed = verifyACK(lastSeqACKd, acksSeq, goBackInfo[winBase].seq, winSize - currentWin);
+        if(numFreed > 0) {
+          lastSlot = (winBase + numFreed - 1) % winSize;
+          if(goBackInfo[lastSlot].retransmitted) rttReset(&rtt);    // Karn's rule: only clear the backoff
+          else rttSample(&rtt, monotonicUsec() - goBackInfo[lastSlot].sentAt);
+          for(int i = 0; i < numFreed; i++) timerCancel(&wheel, &goBackInfo[(winBase + i) % winSize].timer);
+          winBase = (winBase + numFreed) % winSize;
+          lastSeqACKd = acksSeq;
+        }
+      }
+
+      // Each datagram newly ACK'd grows the window, in selective repeat also those beyond a missing one
+      if(transferMode == MODE_SR) numAcked = numFreed >= 0;
+      else numAcked = numFreed > 0 ? numFreed : 0;
+      if(transferMode == MODE_SR && acks[a].ext) {
+        numSacked = markSackInfo(goBackInfo, &acks[a], &winBase, winSize - currentWin - (numFreed > 0 ? numFreed : 0),
+            winSize, &wheel, &numAcked);
+        if(numSacked > 0) numFreed = (numFreed > 0 ? numFreed : 0) + numSacked;
+      }
+      if(numAcked > 0) ccAck(&cc, numAcked, monotonicUsec(), rtt.srtt);
+
+      if(numFreed > 0) {
+        currentWin += numFreed;
+        numDupAcks = 0;
+      } else if(numFreed == 0 && currentWin < winSize && ++numDupAcks == DUP_ACK_THRESH) {
+        ccLoss(&cc, goBackInfo[winBase].sentAt, monotonicUsec());
+        fastRetransmit(goBackInfo, winBase, winSize - currentWin, winSize, &wheel);
+        resendPending = 1;
+        resendReason = "Fast retransmit";
+      }
+
+      // Keep draining while each recvmmsg call comes back full
+      if(a == numAcks - 1 && numAcks == ACK_BATCH) {
+        numAcks = getAcks(&sockfd, acks, &receiverBusy);
+        a = -1;
+      }
     }
-    if(currentWin > 0 && noMoreData == 0) {
-      numRead = readFile(fileBuffer, maxSegSize);
+
+    // Every datagram the congestion window allows is queued, then the batch is sent with one sendmmsg
+    // While the server asks the client to slow down, only one datagram is in flight at a time,
+    // which still carries the ACK that says when it has caught up
+    // Resends waiting for the pacer go first, a Go-Back-N server would discard anything after them
+    now = monotonicUsec();
+    while(winSize - currentWin < sendWindow(&cc, peerWin) && noMoreData == 0 && !(receiverBusy && currentWin < winSize) &&
+        !resendPending && pacerReady(&pacer, now)) {
+      // The datagram is built in place in its send ring slot
+      sndDatagram = ringSlot(&goBackDgrams, goBackDgramPtr);
+      numRead = readFile(&sndDatagram[headerLen], maxSegSize, &dgramData, &dataChk);
       
       if(numRead <= 0) noMoreData = 1;
       else {
         // START - Send packet
-        addData(sndDatagram, fileBuffer, maxSegSize);
-        makeHeader(sndDatagram, maxSegSize);
+        makeHeader(sndDatagram, dataChk);
 
         // START - Save packet
-        savePacket(sndDatagram, goBackDgrams, goBackDgramPtr, maxSegSize);
+        goBackInfo[goBackDgramPtr].seq = sequenceNumber;
+        goBackInfo[goBackDgramPtr].len = numRead + headerLen;
+        goBackInfo[goBackDgramPtr].data = dgramData;
+        goBackInfo[goBackDgramPtr].acked = 0;
+        goBackInfo[goBackDgramPtr].retransmitted = 0;
+        goBackInfo[goBackDgramPtr].sentAt = monotonicUsec();
+        goBackInfo[goBackDgramPtr].timer.slot = goBackDgramPtr;
+        timerArm(&wheel, &goBackInfo[goBackDgramPtr].timer, goBackInfo[goBackDgramPtr].sentAt + rtt.rto);
         goBackDgramPtr++;
         if(goBackDgramPtr == winSize) goBackDgramPtr = 0;
         // END - save packet
 
-        sendSize = sendDatagram(&sockfd, &server_addr, sndDatagram, numRead+8);  
+        batchAdd(&batch, &sockfd, &server_addr, sndDatagram, dgramData, numRead);  
+        pacerSpend(&pacer, numRead + headerLen);
 
 #ifdef DEBUG
-        printf("numRead: %lu, sendSize: %lu\n", numRead, sendSize);
+        printf("numRead: %lu\n", numRead);
 #endif
-
-        clearBuffers(sndDatagram, fileBuffer, maxSegSize);
         // END - send packet
 
-        lastSeqSent = sequenceNumber;
-        sequenceNumber++;
-        if (sequenceNumber == USHRT_MAX) sequenceNumber = 0;    // refer to getAck()
+        sequenceNumber++;     // Wraps from UINT32_MAX to 0, refer to seqDist()
+        bytesSent += numRead;
         
-        totalNumDgramsSent++;
         currentWin--;
-        if(timer.tv_sec == -1) startTimer(&timer);  // First loop: timer has never been started
       }
     }
+    batchFlush(&batch, &sockfd);
   }
   //** End file sending **/
 
-  closeConnection(&sockfd, &server_addr, sndDatagram);  
+  printf("Client: stream %d %s: cwnd %.1f, ssthresh %.1f, max cwnd %.1f, %lu losses, %lu timeouts, pacing %.1f Mbit/s, "
+      "%lu bad ACKs, %lu datagrams resent\n", st->index, cc.algo->name, cc.cwnd, cc.ssthresh, cc.maxCwnd, cc.losses,
+      cc.timeouts, pacer.rate * 8 / 1e6, numBadAcks, numResent);
+  closeConnection(&sockfd, &server_addr, bytesSent, &rtt);
   close(sockfd);
-  for(int i=0; i<winSize; i++) {
-    free(goBackDgrams[i]);
-  }
-  free(goBackDgrams);
-  free(sndDatagram);
-  free(fileBuffer);
-  fclose(fileToTransfer);  
-  exit(0);
+  free(goBackDgrams.slots);
+  free(goBackInfo);
+  free(firedTimers);
+}
+
+/**
+ * streamThread - connects and sends a stream after the first
+ * @arg: The stream
+ **/
+void *streamThread(void *arg)
+{
+  struct stream *st = (struct stream*) arg;
+
+  streamConnect(st);
+  if(connId == 0) {
+    fprintf(stderr, "Client: the server did not accept stream %d\n", st->index);
+    exit(1);
+  }
+  streamSend(st);
+  return NULL;
+}
+
+int main(int argc, char *argv[])
+{
+  int portno, opt;                            // The port number
+  size_t fileSize, numSegs;                   // The file's size, and the segments it's cut into
+  struct fileReader reader;                   // A stream's byte range of the file
+  struct hostent *server;                     // Hostent struct that keeps relevant host info. Such as official name and address family.
+  char *host_name, *file_name;                // The host name and file name retrieve from command line
+  struct stream first = {0}, *streams;        // The first stream's settings are copied to the others
+  char *impairSpec = NULL;                    // The -I impairment of the ACKs
+
+  first.rtt.rto = TIMEOUT * 1000000;
+  first.rtt.minRto = MIN_RTO_MSEC * 1000;
+  first.rtt.maxRto = MAX_RTO_MSEC * 1000;
+
+  while((opt = getopt(argc, argv, "c:C:gI:rn:m:M:P:R:uV")) != -1) {
+    switch(opt) {
+      case 'c': congestionAlgo = ccFind(optarg); break;
+      case 'C': checksumAlgo = strcmp(optarg, "none") == 0 ? CHK_NONE : strcmp(optarg, "inet16") == 0 ? CHK_INET16 : -1; break;
+      case 'g': first.gso = 1; break;
+      case 'I': impairSpec = optarg; break;
+      case 'r': selectiveRepeat = 1; break;
+      case 'n': uploadName = optarg; break;
+      case 'm': first.rtt.minRto = strtoull(optarg, NULL, 10) * 1000; break;
+      case 'M': first.rtt.maxRto = strtoull(optarg, NULL, 10) * 1000; break;
+      case 'P': numStreams = atoi(optarg); break;
+      case 'R': maxPacingRate = atof(optarg) * 1e6 / 8; break;
+      case 'u': resumeUpload = 1; break;
+      case 'V': verifyHash = 1; break;
+      default: argc = 0;
+    }
+  }
+
+  impairDefaults(&ackImpairCfg);
+  if (argc - optind < 5 || congestionAlgo == NULL || checksumAlgo < 0 || first.rtt.minRto == 0 || first.rtt.minRto > first.rtt.maxRto ||
+      impairParse(&ackImpairCfg, impairSpec) < 0 || impairTimed(&ackImpairCfg) || numStreams < 1 || numStreams > MAX_STREAMS || maxPacingRate < 0 ||
+      (uploadName != NULL && (strlen(uploadName) == 0 || strlen(uploadName) > MAX_NAME_LEN))) {
+    fprintf(stderr,"usage: %s [-c reno|cubic|fixed] [-C inet16|none] [-g] [-I impairment] [-r] [-n name] [-P streams] [-R mbit/s] [-u] [-V] [-m min-rto-ms] [-M max-rto-ms] hostname port file-name N MSS\n", argv[0]);
+    fprintf(stderr,"  -c: the congestion control, N caps the window it grows (default reno)\n");
+    fprintf(stderr,"  -C: the checksum covering the data, if the server agrees (default inet16)\n");
+    fprintf(stderr,"  -g: send runs of full segments with UDP segmentation offload\n");
+    fprintf(stderr,"  -I: lose or corrupt received ACKs: seed=N, loss=P, ge=P:R[:LOSSGOOD[:LOSSBAD]], corrupt=P\n");
+    fprintf(stderr,"  -r: request selective repeat instead of Go-Back-N\n");
+    fprintf(stderr,"  -n: the name a server writing uploads to a directory saves the file under (1-%d bytes)\n", MAX_NAME_LEN);
+    fprintf(stderr,"  -P: split the file into byte ranges sent over parallel streams, each with a window of N (1-%d)\n",
+        MAX_STREAMS);
+    fprintf(stderr,"  -R: the rate the file is sent no faster than, in Mbit/s, shared by the streams (default no cap)\n");
+    fprintf(stderr,"  -u: resume an upload that was cut off after the bytes the server has\n");
+    fprintf(stderr,"  -V: have the server check its copy against a hash of the file\n");
+    fprintf(stderr,"  -m, -M: bounds of the retransmission timeout (default %d, %d)\n", MIN_RTO_MSEC, MAX_RTO_MSEC);
+    exit(1);
+  }
+  clampRto(&first.rtt);
+  if(impairSpec != NULL) printf("Client: ACK impairment seed: %llu\n", (unsigned long long) impairPickSeed(&ackImpairCfg));
+
+  //*** Init - Begin ***
+
+  argv += optind - 1;   // Positional arguments keep their original indices
+  host_name = argv[1];
+  portno = atoi(argv[2]);
+  file_name = argv[3];
+  first.winSize = atoi(argv[4]);
+  if(first.winSize < 1 || first.winSize > MAX_WINDOW) error("ERROR: the window N must be from 1 to 1048576 packets");
+  first.maxSegSize = atoi(argv[5]);
+  if(atoi(argv[5]) < 1 || first.maxSegSize > MAX_MSS) error("ERROR: the MSS must be from 1 to 65495 bytes");
+
+  // Sets all variables in the server_addr struct to 0 to prevent "junk" 
+  // in the variables. "Always pass structures by reference w/ the 
+  // size of the structure." 
+  memset((char *) &first.server_addr, 0, sizeof(first.server_addr));
+
+  first.server_addr.sin_family = AF_INET;					// Internet Address Family 
+  first.server_addr.sin_port = htons(portno);		  // Port Number in Network Byte Order 
+
+  // Retrieves the host information based on the address
+  // passed from the users commandline. 
+  server = gethostbyname(argv[1]);
+  if (server == NULL) error("ERROR, no such host");
+
+  // Copies the server info into the the appropriate socket struct. 
+  bcopy((char *) server->h_addr, (char *) &first.server_addr.sin_addr.s_addr, server->h_length);
+
+  openFile(argv[3]);
+  first.reader = fileToTransfer;
+
+  // Each stream sends at least one full segment of the MSS asked for of a mapped file
+  fileSize = fileToTransfer.end;
+  if(numStreams > 1 && !fileToTransfer.mapped) {
+    printf("Client: only a regular file can be split into streams, sending one stream\n");
+    numStreams = 1;
+  }
+  numSegs = (fileSize + first.maxSegSize - 1) / first.maxSegSize;
+  if(numStreams > 1 && (size_t) numStreams > numSegs) numStreams = numSegs;
+
+  // Every range is set before the first SYN, which carries the length of the first stream's. The
+  // file's segments of the MSS asked for are dealt out in runs, stream i sending segments
+  // i * numSegs / numStreams up to (i + 1) * numSegs / numStreams. With no more streams than
+  // segments no range is empty. An MSS agreed or probed smaller than the one asked for only
+  // leaves the last segment of each range short.
+  streams = (struct stream*) calloc(numStreams, sizeof(*streams));
+  if (streams == NULL) error("Stream memory allocation failure\n");
+  for(int i = 0; i < numStreams; i++) {
+    streams[i].reader = fileToTransfer;
+    if(numStreams == 1) break;
+    streams[i].reader.start = i * numSegs / numStreams * first.maxSegSize;
+    streams[i].reader.end = (i == numStreams - 1) ? fileSize : (i + 1) * numSegs / numStreams * first.maxSegSize;
+  }
+  first.reader = streams[0].reader;
+
+  // The cap is shared by the streams, before the first one connects
+  maxPacingRate /= numStreams;
+
+  streamConnect(&first);
+  if(numStreams > 1 && connId == 0) {
+    printf("Client: the server can't join streams, sending one stream\n");
+    maxPacingRate *= numStreams;
+    numStreams = 1;
+    first.reader = fileToTransfer;
+    streams[0].reader = fileToTransfer;
+  }
+  firstConnId = connId;
+
+  // Every stream starts from the first one's MSS, socket settings and estimators
+  for(int i = 0; i < numStreams; i++) {
+    reader = streams[i].reader;
+    streams[i] = first;
+    streams[i].index = i;
+    streams[i].reader = reader;
+  }
+
+  //*** Init - End ***
+
+  for(int i = 1; i < numStreams; i++)
+    if(pthread_create(&streams[i].thread, NULL, streamThread, &streams[i]) != 0) error("Error starting a stream");
+  streamSend(&streams[0]);
+  for(int i = 1; i < numStreams; i++) pthread_join(streams[i].thread, NULL);
+
+  closeFile();
+  free(streams);
+  exit(hashMismatch);
 }
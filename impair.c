@@ -0,0 +1,249 @@
+// File: impair.c
+// Name: Seth Butler
+// Project: 2
+// Class: Internet Protocols
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "impair.h"
+
+#define PROB_ONE (1ULL << 32)	// The threshold of a probability of 1
+
+/**
+ * splitmix64 - scrambles a 64-bit value, which spreads out seeds that are close together
+ * @x: The value
+ *
+ * Return: uint64_t - the scrambled value
+ **/
+static uint64_t splitmix64(uint64_t x)
+{
+  x += 0x9e3779b97f4a7c15ULL;
+  x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+  return x ^ (x >> 31);
+}
+
+/**
+ * nextRandom - the next number of a stream, from xorshift64*
+ * @st: The stream
+ *
+ * Return: uint64_t - the number, whose high 32 bits are the best
+ **/
+static inline uint64_t nextRandom(struct impairState *st)
+{
+  uint64_t x = st->rng;
+
+  x ^= x >> 12;
+  x ^= x << 25;
+  x ^= x >> 27;
+  st->rng = x;
+  return x * 0x2545f4914f6cdd1dULL;
+}
+
+/**
+ * chance - decides if something with a probability happens
+ * @st: The stream
+ * @threshold: The probability out of 2^32. A probability of 0 draws no number, so a setting
+ *   that's off doesn't change the decisions of the others
+ *
+ * Return: int - 1 if it happens, 0 if not
+ **/
+static inline int chance(struct impairState *st, uint64_t threshold)
+{
+  return threshold && (nextRandom(st) >> 32) < threshold;
+}
+
+/**
+ * toThreshold - turns a probability into a threshold out of 2^32
+ * @prob: The probability, clamped to 0..1
+ *
+ * Return: uint64_t - the threshold
+ **/
+static uint64_t toThreshold(double prob)
+{
+  if(!(prob > 0)) return 0;
+  if(prob >= 1) return PROB_ONE;
+  return (uint64_t) (prob * PROB_ONE);
+}
+
+/**
+ * parseProb - reads a probability
+ * @str: Where it starts
+ * @end: Set to the first character after it
+ * @threshold: Set to the probability as a threshold
+ *
+ * Return: int - 0 on success, -1 if it isn't a number from 0 to 1
+ **/
+static int parseProb(const char *str, char **end, uint64_t *threshold)
+{
+  double prob = strtod(str, end);
+
+  if(*end == str || prob < 0 || prob > 1) return -1;
+  *threshold = toThreshold(prob);
+  return 0;
+}
+
+/**
+ * parseMs - reads a time in milliseconds
+ * @str: Where it starts
+ * @end: Set to the first character after it
+ * @usec: Set to the time in microseconds
+ *
+ * Return: int - 0 on success, -1 if it isn't a number 0 or more
+ **/
+static int parseMs(const char *str, char **end, uint64_t *usec)
+{
+  double ms = strtod(str, end);
+
+  if(*end == str || !(ms >= 0)) return -1;
+  *usec = (uint64_t) (ms * 1000);
+  return 0;
+}
+
+void impairDefaults(struct impairConfig *cfg)
+{
+  memset(cfg, 0, sizeof(*cfg));
+  cfg->geLossBad = PROB_ONE;
+  cfg->reorderUsec = IMPAIR_REORDER_MS * 1000;
+  cfg->limit = IMPAIR_LIMIT;
+}
+
+void impairSetLoss(struct impairConfig *cfg, double prob)
+{
+  cfg->loss = toThreshold(prob);
+}
+
+int impairParse(struct impairConfig *cfg, const char *spec)
+{
+  char *copy, *key, *value, *end, *save = NULL;
+  int ret = 0;
+
+  if(spec == NULL) return 0;
+  copy = strdup(spec);
+  if(copy == NULL) return -1;
+
+  for(key = strtok_r(copy, ",", &save); key != NULL && ret == 0; key = strtok_r(NULL, ",", &save)) {
+    value = strchr(key, '=');
+    if(value == NULL) {
+      ret = -1;
+      break;
+    }
+    *value++ = '\0';
+    end = value;
+
+    if(strcmp(key, "seed") == 0) {
+      cfg->seed = strtoull(value, &end, 0);
+      cfg->seeded = 1;
+      if(end == value) ret = -1;
+    }
+    else if(strcmp(key, "loss") == 0) ret = parseProb(value, &end, &cfg->loss);
+    else if(strcmp(key, "ge") == 0) {
+      cfg->useGe = 1;
+      ret = parseProb(value, &end, &cfg->geP);
+      if(ret == 0 && *end == ':') ret = parseProb(end + 1, &end, &cfg->geR);
+      else ret = -1;
+      if(ret == 0 && *end == ':') ret = parseProb(end + 1, &end, &cfg->geLossGood);
+      if(ret == 0 && *end == ':') ret = parseProb(end + 1, &end, &cfg->geLossBad);
+    }
+    else if(strcmp(key, "dup") == 0) ret = parseProb(value, &end, &cfg->dup);
+    else if(strcmp(key, "corrupt") == 0) ret = parseProb(value, &end, &cfg->corrupt);
+    else if(strcmp(key, "delay") == 0) ret = parseMs(value, &end, &cfg->delayUsec);
+    else if(strcmp(key, "jitter") == 0) ret = parseMs(value, &end, &cfg->jitterUsec);
+    else if(strcmp(key, "reorder") == 0) {
+      ret = parseProb(value, &end, &cfg->reorder);
+      if(ret == 0 && *end == ':') ret = parseMs(end + 1, &end, &cfg->reorderUsec);
+    }
+    else if(strcmp(key, "rate") == 0) {
+      double mbit = strtod(value, &end);
+
+      if(end == value || !(mbit >= 0)) ret = -1;
+      cfg->rateBps = (uint64_t) (mbit * 125000);	// Megabits to bytes
+    }
+    else if(strcmp(key, "limit") == 0) {
+      cfg->limit = strtoul(value, &end, 10);
+      if(end == value || cfg->limit == 0) ret = -1;
+    }
+    else ret = -1;
+
+    if(*end != '\0') ret = -1;
+  }
+
+  free(copy);
+  return ret;
+}
+
+uint64_t impairPickSeed(struct impairConfig *cfg)
+{
+  struct timespec now;
+
+  if(!cfg->seeded) {
+    clock_gettime(CLOCK_REALTIME, &now);
+    cfg->seed = splitmix64(((uint64_t) now.tv_sec << 32) ^ now.tv_nsec ^ ((uint64_t) getpid() << 16));
+    cfg->seeded = 1;
+  }
+  return cfg->seed;
+}
+
+int impairTimed(const struct impairConfig *cfg)
+{
+  return cfg->delayUsec || cfg->jitterUsec || cfg->reorder || cfg->rateBps;
+}
+
+void impairInit(struct impairState *st, const struct impairConfig *cfg, uint64_t stream)
+{
+  memset(st, 0, sizeof(*st));
+  st->cfg = cfg;
+  st->rng = splitmix64(cfg->seed ^ splitmix64(stream));
+  if(st->rng == 0) st->rng = 1;	// xorshift never leaves 0
+  st->active = cfg->loss || cfg->useGe || cfg->dup || cfg->corrupt || cfg->jitterUsec || cfg->reorder;
+}
+
+int impairDatagram(struct impairState *st, unsigned char *dgram, size_t len)
+{
+  const struct impairConfig *cfg = st->cfg;
+  int verdict = IMPAIR_PASS;
+  uint64_t bit;
+
+  st->stats.seen++;
+  if(!st->active) return IMPAIR_PASS;
+
+  if(cfg->useGe) {
+    if(st->bad) st->bad = !chance(st, cfg->geR);
+    else st->bad = chance(st, cfg->geP);
+  }
+  if(chance(st, cfg->loss) || (cfg->useGe && chance(st, st->bad ? cfg->geLossBad : cfg->geLossGood))) {
+    st->stats.lost++;
+    return IMPAIR_DROP;
+  }
+
+  if(chance(st, cfg->dup)) {
+    st->stats.duplicated++;
+    verdict |= IMPAIR_DUP;
+  }
+  if(len > 0 && chance(st, cfg->corrupt)) {
+    bit = (nextRandom(st) >> 32) % (len * 8);
+    dgram[bit >> 3] ^= 1 << (bit & 7);
+    st->stats.corrupted++;
+    verdict |= IMPAIR_CORRUPT;
+  }
+  return verdict;
+}
+
+uint64_t impairHold(struct impairState *st, int *reordered)
+{
+  const struct impairConfig *cfg = st->cfg;
+  uint64_t usec = cfg->delayUsec;
+
+  *reordered = 0;
+  if(!st->active) return usec;
+  if(cfg->jitterUsec) usec += (nextRandom(st) >> 32) % (cfg->jitterUsec + 1);
+  if(chance(st, cfg->reorder)) {
+    usec += cfg->reorderUsec;
+    st->stats.reordered++;
+    *reordered = 1;
+  }
+  return usec;
+}
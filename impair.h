@@ -0,0 +1,159 @@
+// File: impair.h
+// Name: Seth Butler
+// Project: 2
+// Class: Internet Protocols
+
+#ifndef IMPAIR_H
+#define IMPAIR_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+ * A network impairment stage: decides, from its own seeded random numbers, what happens to each
+ * datagram passing through it. The same spec and seed impair the same datagrams the same way on
+ * every run. Loss, duplication and corruption are decided the moment a datagram arrives, so an
+ * endpoint can apply them itself; delay, jitter, reordering and the rate limit hold datagrams
+ * back and need a queue, which impairproxy keeps.
+ *
+ * A spec is a comma separated list of key=value settings, for example
+ *   "seed=42,ge=0.01:0.3,dup=0.001,corrupt=0.0001,delay=20,jitter=5,reorder=0.01,rate=100"
+ */
+
+#define IMPAIR_PASS 0		// Deliver the datagram as it is
+#define IMPAIR_DROP 1		// Lose the datagram
+#define IMPAIR_DUP 2		// Deliver the datagram twice
+#define IMPAIR_CORRUPT 4	// A bit of the datagram was flipped
+
+#define IMPAIR_REORDER_MS 1.0	// How much longer than the rest a reordered datagram is held by default
+#define IMPAIR_LIMIT 1000	// The default number of datagrams the proxy's queue holds before it drops
+
+/**
+ * impairConfig - the settings of an impairment stage. A probability is kept as a threshold out
+ * of 2^32 so each decision is one integer compare
+ * @seed: The seed of the stage's random numbers
+ * @loss: Probability each datagram is lost on its own (Bernoulli)
+ * @geP: Gilbert-Elliott probability of going from the good state to the bad one per datagram
+ * @geR: Gilbert-Elliott probability of going from the bad state back to the good one
+ * @geLossGood: Probability a datagram is lost in the good state
+ * @geLossBad: Probability a datagram is lost in the bad state
+ * @dup: Probability a datagram is delivered twice
+ * @corrupt: Probability one bit of a datagram is flipped
+ * @reorder: Probability a datagram is held back longer than the ones after it
+ * @delayUsec: How long every datagram is held, in microseconds
+ * @jitterUsec: The most extra time, picked uniformly, a datagram is held, in microseconds. Jitter
+ *   alone keeps datagrams in order, a datagram is never due before the one ahead of it
+ * @reorderUsec: The extra time a reordered datagram is held, in microseconds
+ * @rateBps: The most bytes per second let through, 0 for no limit
+ * @limit: The most datagrams waiting in the queue, later ones are dropped
+ * @useGe: 1 if the Gilbert-Elliott model is on
+ * @seeded: 1 once the seed is set by a spec or picked
+ **/
+struct impairConfig {
+  uint64_t seed;
+  uint64_t loss, geP, geR, geLossGood, geLossBad;
+  uint64_t dup, corrupt, reorder;
+  uint64_t delayUsec, jitterUsec, reorderUsec;
+  uint64_t rateBps;
+  uint32_t limit;
+  int useGe;
+  int seeded;
+};
+
+/**
+ * impairStats - what an impairment stage has done
+ * @seen: Datagrams that passed through the stage
+ * @lost: Datagrams lost
+ * @duplicated: Datagrams delivered twice
+ * @corrupted: Datagrams with a bit flipped
+ * @reordered: Datagrams held back longer than the ones after them
+ * @overflowed: Datagrams dropped because the queue was full
+ **/
+struct impairStats {
+  uint64_t seen, lost, duplicated, corrupted, reordered, overflowed;
+};
+
+/**
+ * impairState - one stream of impairment decisions
+ * @cfg: The settings, shared by every stream of the stage
+ * @rng: The xorshift64* random number state
+ * @bad: 1 while the Gilbert-Elliott model is in the bad state
+ * @active: 0 if the settings never impair a datagram, which skips the random numbers
+ * @stats: What the stream has done
+ **/
+struct impairState {
+  const struct impairConfig *cfg;
+  uint64_t rng;
+  int bad;
+  int active;
+  struct impairStats stats;
+};
+
+/**
+ * impairDefaults - the settings of a stage that doesn't impair anything
+ * @cfg: The settings to fill in
+ **/
+void impairDefaults(struct impairConfig *cfg);
+
+/**
+ * impairSetLoss - sets the probability each datagram is lost on its own
+ * @cfg: The settings
+ * @prob: The probability, clamped to 0..1
+ **/
+void impairSetLoss(struct impairConfig *cfg, double prob);
+
+/**
+ * impairParse - adds the settings of a spec to a stage's settings
+ * @cfg: The settings, which keep their value for the keys the spec doesn't have
+ * @spec: The key=value list: seed=N, loss=P, ge=P:R[:LOSSGOOD[:LOSSBAD]], dup=P, corrupt=P,
+ *   delay=MS, jitter=MS, reorder=P[:MS], rate=MBIT and limit=N
+ *
+ * Return: int - 0 on success, -1 if a key is unknown or a value doesn't parse
+ **/
+int impairParse(struct impairConfig *cfg, const char *spec);
+
+/**
+ * impairPickSeed - picks a seed from the clock if the settings don't have one yet
+ * @cfg: The settings
+ *
+ * Return: uint64_t - the seed, to print so a run can be repeated
+ **/
+uint64_t impairPickSeed(struct impairConfig *cfg);
+
+/**
+ * impairTimed - tells if the settings hold datagrams back, which only a queue can do
+ * @cfg: The settings
+ *
+ * Return: int - 1 if delay, jitter, reordering or a rate limit is set, 0 otherwise
+ **/
+int impairTimed(const struct impairConfig *cfg);
+
+/**
+ * impairInit - starts a stream of decisions
+ * @st: The stream
+ * @cfg: The settings, which must outlive the stream
+ * @stream: Told apart from the other streams of the same seed, such as a worker's index
+ **/
+void impairInit(struct impairState *st, const struct impairConfig *cfg, uint64_t stream);
+
+/**
+ * impairDatagram - decides what happens to a datagram, flipping a bit of it if it's corrupted
+ * @st: The stream
+ * @dgram: The datagram
+ * @len: Its length
+ *
+ * Return: int - IMPAIR_PASS, IMPAIR_DROP, or IMPAIR_DUP and IMPAIR_CORRUPT or'd together
+ **/
+int impairDatagram(struct impairState *st, unsigned char *dgram, size_t len);
+
+/**
+ * impairHold - decides how long a datagram is held before it's delivered
+ * @st: The stream
+ * @reordered: Set to 1 if the datagram is reordered, 0 if not
+ *
+ * Return: uint64_t - The time in microseconds: the delay, the jitter and, if the datagram is
+ *   reordered, the reorder time
+ **/
+uint64_t impairHold(struct impairState *st, int *reordered);
+
+#endif
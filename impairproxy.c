@@ -0,0 +1,404 @@
+// File: impairproxy.c
+// Name: Seth Butler
+// Project: 2
+// Class: Internet Protocols
+
+#define _GNU_SOURCE   // ppoll
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+
+#include "impair.h"
+
+/*
+ * A UDP proxy that impairs the datagrams between the clients and a server. Each client address
+ * gets its own socket toward the server, so the server sees one address per client as it would
+ * without the proxy. Datagrams toward the server go through the -s impairment, the ones coming
+ * back through the -a impairment. Datagrams that aren't lost wait in a queue ordered by the time
+ * they're due: a rate limit holds each one until the link is free, then the delay, jitter and
+ * reordering hold it a little longer. Only a reordered datagram is passed by the ones after it.
+ */
+
+#define DGRAM_SIZE 65536       // The largest datagram carried
+#define MAX_FLOWS 64           // The clients forwarded at once, the one heard from least recently is replaced
+#define DIR_TO_SERVER 0
+#define DIR_TO_CLIENT 1
+
+/**
+ * flow - a client and the socket its datagrams are forwarded to the server from
+ * @client: The client's address
+ * @sockfd: The socket toward the server, 0 while the flow is unused
+ * @lastHeard: When the client last sent a datagram, to replace the oldest flow
+ **/
+struct flow {
+  struct sockaddr_in client;
+  int sockfd;
+  uint64_t lastHeard;
+};
+
+/**
+ * held - a datagram waiting in the queue
+ * @due: When it's sent, in microseconds
+ * @order: When it arrived among all datagrams, which keeps datagrams due at once in order
+ * @dir: DIR_TO_SERVER or DIR_TO_CLIENT
+ * @flow: The flow it belongs to
+ * @len: Its length
+ * @data: Its bytes
+ **/
+struct held {
+  uint64_t due;
+  uint64_t order;
+  int dir;
+  struct flow *flow;
+  size_t len;
+  unsigned char *data;
+};
+
+/**
+ * direction - one way through the proxy
+ * @cfg: Its impairment settings
+ * @impair: Its impairment decisions
+ * @linkFree: When the rate limited link is done sending the datagrams queued for it
+ * @lastDue: When the last datagram not reordered is due, the next isn't due before it
+ * @queued: The datagrams of the direction in the queue
+ **/
+struct direction {
+  struct impairConfig cfg;
+  struct impairState impair;
+  uint64_t linkFree;
+  uint64_t lastDue;
+  uint32_t queued;
+};
+
+struct direction dirs[2];
+struct flow flows[MAX_FLOWS];
+struct sockaddr_in serverAddr;
+int listenfd;
+
+struct held *heap;             // The queue, a binary min-heap by due time
+size_t heapLen = 0, heapCap = 0;
+uint64_t arrivals = 0;
+
+volatile sig_atomic_t stopping = 0;
+
+/**
+* error - prints the value of errno & exit
+* @msg: The specific message to preceed the error
+**/
+void error(const char *msg)
+{
+  perror(msg);
+  exit(1);
+}
+
+/**
+ * monotonicUsec - the time on the monotonic clock
+ *
+ * Return: uint64_t - the time in microseconds
+ **/
+uint64_t monotonicUsec(void)
+{
+  struct timespec now;
+
+  if(clock_gettime(CLOCK_MONOTONIC, &now) != 0) error("ERROR: clock_gettime failed");
+  return (uint64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+/**
+ * heldBefore - tells if a queued datagram is sent before another
+ * @a: One datagram
+ * @b: The other
+ *
+ * Return: int - 1 if a goes first, 0 otherwise
+ **/
+static inline int heldBefore(const struct held *a, const struct held *b)
+{
+  return a->due < b->due || (a->due == b->due && a->order < b->order);
+}
+
+/**
+ * heapPush - adds a datagram to the queue
+ * @h: The datagram, whose data the queue takes
+ **/
+void heapPush(struct held *h)
+{
+  size_t i, parent;
+
+  if(heapLen == heapCap) {
+    heapCap = heapCap ? heapCap * 2 : 1024;
+    heap = (struct held*) realloc(heap, heapCap * sizeof(*heap));
+    if(heap == NULL) error("Queue memory allocation failure\n");
+  }
+  for(i = heapLen++; i > 0 && heldBefore(h, &heap[parent = (i - 1) / 2]); i = parent) heap[i] = heap[parent];
+  heap[i] = *h;
+}
+
+/**
+ * heapPop - takes the datagram sent first out of the queue
+ * @h: Filled with the datagram
+ **/
+void heapPop(struct held *h)
+{
+  struct held last = heap[--heapLen];
+  size_t i = 0, child;
+
+  *h = heap[0];
+  while((child = 2 * i + 1) < heapLen) {
+    if(child + 1 < heapLen && heldBefore(&heap[child + 1], &heap[child])) child++;
+    if(!heldBefore(&heap[child], &last)) break;
+    heap[i] = heap[child];
+    i = child;
+  }
+  heap[i] = last;
+}
+
+/**
+ * flowFor - finds the flow of a client, starting one if it's new
+ * @client: The client's address
+ * @now: The time
+ *
+ * Return: struct flow* - the flow
+ **/
+struct flow *flowFor(const struct sockaddr_in *client, uint64_t now)
+{
+  struct flow *f, *oldest = &flows[0];
+
+  for(int i = 0; i < MAX_FLOWS; i++) {
+    f = &flows[i];
+    if(f->sockfd != 0 && f->client.sin_port == client->sin_port && f->client.sin_addr.s_addr == client->sin_addr.s_addr) {
+      f->lastHeard = now;
+      return f;
+    }
+    if(f->sockfd == 0 || (oldest->sockfd != 0 && f->lastHeard < oldest->lastHeard)) oldest = f;
+  }
+
+  // Datagrams still queued for a replaced flow go out its new client's way, as a NAT rebinding would
+  f = oldest;
+  if(f->sockfd == 0) {
+    f->sockfd = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    if(f->sockfd < 0) error("ERROR opening socket");
+    fcntl(f->sockfd, F_SETFL, O_NONBLOCK);
+  }
+  f->client = *client;
+  f->lastHeard = now;
+  return f;
+}
+
+/**
+ * impairAndQueue - puts a datagram through a direction's impairment and queues what's left of it
+ * @dir: DIR_TO_SERVER or DIR_TO_CLIENT
+ * @f: The flow it belongs to
+ * @buf: The datagram
+ * @len: Its length
+ * @now: When it arrived
+ **/
+void impairAndQueue(int dir, struct flow *f, unsigned char *buf, size_t len, uint64_t now)
+{
+  struct direction *d = &dirs[dir];
+  struct held h;
+  int verdict = impairDatagram(&d->impair, buf, len), reordered;
+
+  if(verdict & IMPAIR_DROP) return;
+
+  for(int copy = 0; copy < ((verdict & IMPAIR_DUP) ? 2 : 1); copy++) {
+    if(d->queued >= d->cfg.limit) {
+      d->impair.stats.overflowed++;
+      return;
+    }
+
+    // The link sends one datagram at a time at the rate, the datagram then takes the delay to arrive
+    h.due = now;
+    if(d->cfg.rateBps) {
+      if(d->linkFree > h.due) h.due = d->linkFree;
+      d->linkFree = h.due + len * 1000000 / d->cfg.rateBps;
+      h.due = d->linkFree;
+    }
+    h.due += impairHold(&d->impair, &reordered);
+    if(!reordered) {
+      if(h.due < d->lastDue) h.due = d->lastDue;
+      d->lastDue = h.due;
+    }
+    h.order = arrivals++;
+    h.dir = dir;
+    h.flow = f;
+    h.len = len;
+    h.data = (unsigned char*) malloc(len ? len : 1);
+    if(h.data == NULL) error("Datagram memory allocation failure\n");
+    memcpy(h.data, buf, len);
+    heapPush(&h);
+    d->queued++;
+  }
+}
+
+/**
+ * sendDue - sends every queued datagram whose time has come
+ * @now: The time
+ *
+ * Return: uint64_t - microseconds until the next datagram is due, or -1 if the queue is empty
+ **/
+uint64_t sendDue(uint64_t now)
+{
+  struct held h;
+
+  while(heapLen > 0 && heap[0].due <= now) {
+    heapPop(&h);
+    dirs[h.dir].queued--;
+    if(h.dir == DIR_TO_SERVER)
+      sendto(h.flow->sockfd, h.data, h.len, 0, (struct sockaddr*) &serverAddr, sizeof(serverAddr));
+    else
+      sendto(listenfd, h.data, h.len, 0, (struct sockaddr*) &h.flow->client, sizeof(h.flow->client));
+    free(h.data);
+  }
+  return heapLen > 0 ? heap[0].due - now : (uint64_t) -1;
+}
+
+/**
+ * printStats - prints what each direction's impairment did
+ **/
+void printStats(void)
+{
+  const char *names[2] = { "to server", "to client" };
+  struct impairStats *s;
+
+  for(int dir = 0; dir < 2; dir++) {
+    s = &dirs[dir].impair.stats;
+    printf("%s: %llu datagrams, %llu lost, %llu duplicated, %llu corrupted, %llu reordered, %llu over the limit\n",
+        names[dir], (unsigned long long) s->seen, (unsigned long long) s->lost, (unsigned long long) s->duplicated,
+        (unsigned long long) s->corrupted, (unsigned long long) s->reordered, (unsigned long long) s->overflowed);
+  }
+}
+
+/**
+ * onSignal - stops the proxy so it prints its statistics
+ * @sig: The signal
+ **/
+void onSignal(int sig)
+{
+  (void) sig;
+  stopping = 1;
+}
+
+int main(int argc, char *argv[])
+{
+  struct sockaddr_in addr;
+  socklen_t addrLen;
+  struct hostent *server;
+  struct pollfd fds[1 + MAX_FLOWS];
+  struct flow *pollFlows[1 + MAX_FLOWS];
+  struct timespec timeout;
+  unsigned char *buf;
+  char *specs[2] = { NULL, NULL };
+  uint64_t now, waitUsec;
+  ssize_t len;
+  int opt, numFds;
+
+  while((opt = getopt(argc, argv, "a:s:")) != -1) {
+    switch(opt) {
+      case 'a': specs[DIR_TO_CLIENT] = optarg; break;
+      case 's': specs[DIR_TO_SERVER] = optarg; break;
+      default: argc = 0;
+    }
+  }
+
+  for(int dir = 0; dir < 2; dir++) {
+    impairDefaults(&dirs[dir].cfg);
+    if(argc > 0 && impairParse(&dirs[dir].cfg, specs[dir]) < 0) {
+      fprintf(stderr, "ERROR: bad impairment: %s\n", specs[dir]);
+      argc = 0;
+    }
+  }
+
+  if (argc - optind < 3) {
+    fprintf(stderr,"usage: %s [-s impairment] [-a impairment] listen-port server-host server-port\n", argv[0]);
+    fprintf(stderr,"  -s: impair the datagrams sent to the server\n");
+    fprintf(stderr,"  -a: impair the datagrams sent back to the clients\n");
+    fprintf(stderr,"  an impairment is a list such as seed=42,ge=0.01:0.3,delay=20,jitter=5,reorder=0.01,rate=100 of\n");
+    fprintf(stderr,"    seed=N, loss=P, ge=P:R[:LOSSGOOD[:LOSSBAD]], dup=P, corrupt=P, delay=MS, jitter=MS,\n");
+    fprintf(stderr,"    reorder=P[:MS] (default %.1f ms later), rate=MBIT and limit=N (default %d datagrams queued)\n",
+        IMPAIR_REORDER_MS, IMPAIR_LIMIT);
+    exit(1);
+  }
+  argv += optind - 1;   // Positional arguments keep their original indices
+
+  // Both directions share the -s seed unless -a has its own, they're told apart as separate streams
+  impairPickSeed(&dirs[DIR_TO_SERVER].cfg);
+  if(!dirs[DIR_TO_CLIENT].cfg.seeded) {
+    dirs[DIR_TO_CLIENT].cfg.seed = dirs[DIR_TO_SERVER].cfg.seed;
+    dirs[DIR_TO_CLIENT].cfg.seeded = 1;
+  }
+  for(int dir = 0; dir < 2; dir++) impairInit(&dirs[dir].impair, &dirs[dir].cfg, dir);
+  printf("Impairment seeds: to server %llu, to client %llu\n", (unsigned long long) dirs[DIR_TO_SERVER].cfg.seed,
+      (unsigned long long) dirs[DIR_TO_CLIENT].cfg.seed);
+
+  memset(&serverAddr, 0, sizeof(serverAddr));
+  serverAddr.sin_family = AF_INET;
+  serverAddr.sin_port = htons(atoi(argv[3]));
+  server = gethostbyname(argv[2]);
+  if (server == NULL) error("ERROR, no such host");
+  memcpy(&serverAddr.sin_addr.s_addr, server->h_addr, server->h_length);
+
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(atoi(argv[1]));
+  addr.sin_addr.s_addr = INADDR_ANY;
+  listenfd = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+  if (listenfd < 0) error("ERROR opening socket");
+  if (bind(listenfd, (struct sockaddr *) &addr, sizeof(addr)) < 0) error("ERROR on binding the socket");
+  fcntl(listenfd, F_SETFL, O_NONBLOCK);
+
+  buf = (unsigned char*) malloc(DGRAM_SIZE);
+  if(buf == NULL) error("Buffer memory allocation failure\n");
+  signal(SIGINT, onSignal);
+  signal(SIGTERM, onSignal);
+
+  while(!stopping) {
+    waitUsec = sendDue(monotonicUsec());
+
+    numFds = 0;
+    fds[numFds].fd = listenfd;
+    fds[numFds].events = POLLIN;
+    pollFlows[numFds++] = NULL;
+    for(int i = 0; i < MAX_FLOWS; i++) {
+      if(flows[i].sockfd == 0) continue;
+      fds[numFds].fd = flows[i].sockfd;
+      fds[numFds].events = POLLIN;
+      pollFlows[numFds++] = &flows[i];
+    }
+
+    timeout.tv_sec = waitUsec / 1000000;
+    timeout.tv_nsec = waitUsec % 1000000 * 1000;
+    if(ppoll(fds, numFds, waitUsec == (uint64_t) -1 ? NULL : &timeout, NULL) < 0) {
+      if(errno == EINTR) continue;
+      error("ERROR on ppoll");
+    }
+
+    // Every datagram waiting is taken, each is timed from when it was read
+    for(int i = 0; i < numFds; i++) {
+      if(!(fds[i].revents & POLLIN)) continue;
+      for(;;) {
+        addrLen = sizeof(addr);
+        len = recvfrom(fds[i].fd, buf, DGRAM_SIZE, 0, (struct sockaddr*) &addr, &addrLen);
+        if(len < 0) break;
+        now = monotonicUsec();
+        if(pollFlows[i] == NULL) impairAndQueue(DIR_TO_SERVER, flowFor(&addr, now), buf, len, now);
+        else impairAndQueue(DIR_TO_CLIENT, pollFlows[i], buf, len, now);
+      }
+    }
+  }
+
+  printStats();
+  free(buf);
+  return 0;
+}
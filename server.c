@@ -3,6 +3,8 @@
 // Project: 2 
 // Class: Internet Protocols 
 
+#define _GNU_SOURCE   // sendmmsg, recvmmsg & fallocate
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -10,22 +12,345 @@
 #include <sys/types.h> 
 #include <sys/socket.h>
 #include <netinet/in.h>
+#include <netinet/udp.h>
+#include <arpa/inet.h>
+#include <sys/uio.h>
+#include <fcntl.h>
+#include <errno.h>
 #include <limits.h>
 #include <time.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <sys/stat.h>
+#include <linux/filter.h>
+
+#include "checksum.h"
+#include "impair.h"
 
 #undef DEBUG
 
-#define BUFFER_SIZE 1032
-#define ACK_DGRAM_SIZE 8
+#define BUFFER_SIZE 1036       // An MSS under the client's 1024 behind the largest (session) header, until a larger one is agreed
+#define LEGACY_MSS (BUFFER_SIZE - DATA_HDR_LEN)  // The MSS of a client that doesn't agree one in the handshake
+#define MAX_MSS (65507 - CONN_HDR_LEN)   // The largest MSS agreed, a full UDP datagram
+#define ACK_DGRAM_SIZE 28      // The longest ACK: an extended ACK, with its SACK bitmap
+#define ACK_HDR_LEN 8          // A version 0 ACK: sequence #, checksum and flag
+#define ACK_EXT_LEN 28         // A version 1 ACK: the version 0 fields, then version, flags, rwnd, cumulative ACK, SACK bitmap
+#define ACK_VERSION 1          // The newest ACK format the server sends
+#define SACK_BITS 64           // The datagrams after the cumulative ACK a SACK bitmap covers
 #define MAX_TIMES_FAIL 128
+#define MAX_SR_WINDOW 4096     // The largest reorder buffer a selective repeat client is granted
+#define RECV_BATCH 32          // The most datagrams taken from one recvmmsg call or ACKs sent with one sendmmsg call
+#define GRO_BUFFER_SIZE 65535  // The receive buffer of each message when the kernel coalesces datagrams (UDP_GRO)
+#define GRO_MAX_SEGS 64        // The most datagrams the kernel coalesces into one message
+#define ARENA_ALIGN 4096       // The alignment of the buffers received datagrams are staged in
+#define WRITE_BATCH 1024       // The most payloads written with one pwritev call (IOV_MAX)
+#define WRITE_QUEUE_SLOTS 4096 // The most payloads received but not yet written each session's writer thread can hold
+#define WRITE_QUEUE_BYTES (16 << 20)   // and the most bytes, which limits the slots when the MSS is large
+#define MAX_REORDER_BYTES (64 << 20)   // The largest reorder ring, which limits the window granted when the MSS is large
+#define DGRAM_OVERHEAD 1024    // What the socket buffer holds for each datagram besides its bytes (headers and bookkeeping)
+#define WRITER_STACK_BYTES (256 << 10) // The stack of each session's writer thread
+#define MEMORY_BUDGET_BYTES (1 << 30)  // The most bytes the write queues, reorder rings and writer stacks of every session hold
+#define HIGH_WATER_PCT 75      // Default percent of the write queue in use at which ACKs ask the client to slow down
+#define SESSION_BUCKETS 256    // The number of buckets in the session table (a power of 2)
+#define MAX_SESSIONS 256       // The most transfers received at once
+#define SESSION_IDLE_SEC 60    // Sessions that haven't sent a datagram for this many seconds are closed
+#define CHECKPOINT_BYTES (16 << 20)   // The bytes written between saves of a session's checkpoint
+#define CKPT_MAGIC 0x3154504b434e4247ULL  // Marks a checkpoint file, "GBNCKPT1" on a little-endian host
+#define REHASH_BUF_SIZE (1 << 20)     // The bytes read back at a time to hash what a resumed session already wrote
+#define DATA_HDR_LEN 8         // The header of a datagram from a client without a connection ID
+#define CONN_HDR_LEN 12        // The header of a session datagram: the data header, then the connection ID
+#define MAX_WORKERS 64         // The most receiver threads, each with its own socket on the port
+
+#ifndef UDP_GRO
+#define UDP_GRO 104
+#endif
+#ifndef SO_ATTACH_REUSEPORT_CBPF
+#define SO_ATTACH_REUSEPORT_CBPF 51
+#endif
+
+// Handshake options, encoded as (type, length, value) in the SYN / SYN-ACK data
+#define OPT_MODE 1
+#define OPT_WINDOW 2
+#define OPT_CONNID 3      // The client asks for a connection ID (0), the SYN-ACK carries it
+#define OPT_NAME 4        // The name the client's file is saved under, used when the server writes to a directory
+#define OPT_JOIN 5        // The connection ID of the session whose file a stream of the same file writes into
+#define OPT_OFFSET 6      // The file offset of a joining stream's first byte (8 bytes)
+#define OPT_ACK_VERSION 7 // The newest ACK format the client reads, the SYN-ACK carries the one the server sends
+#define OPT_MSS 8         // The client's MSS, the SYN-ACK carries the MSS agreed
+#define OPT_CHECKSUM 9    // The checksum the client asks to cover data with, the SYN-ACK carries the one agreed
+#define OPT_ISN 10        // The sequence # of the client's first datagram, echoed in the SYN-ACK
+#define OPT_LENGTH 11     // The number of bytes the client will send, the output is preallocated for them (8 bytes)
+#define OPT_RESUME 12     // The client asks to resume, the SYN-ACK carries the bytes already on disk (8 bytes)
+#define OPT_HASH 13       // The client asks for the file to be checked with a hash in the FIN, the SYN-ACK agrees
+#define OPT_STREAMS 14    // The number of streams the client splits its file into, sent by the first stream
+#define HASH_FNV1A64 1    // The FNV-1a 64 hash of the stream's bytes
+#define CHK_INET16 0      // The 16-bit one's complement sum
+#define CHK_NONE 1        // No checksum on data, for links that already have one
+#define MODE_GBN 0
+#define MODE_SR 1
 
-uint32_t sequenceNumberExpected = 0;    // the USHRT_MAX for this variable is used to signify a failed ACK on the client side
 const uint16_t pseudoChksum = 0b0000000000000000;
 const uint16_t ackFlag = 0b1010101010101010;
 const uint16_t dataFlag = 0b0101010101010101;   // (21,845) - base 10
 const uint16_t closeFlag = 0b1111111111111111;
+const uint16_t synFlag = 0b1100110011001100;
+const uint16_t synAckFlag = 0b0011001100110011;
+const uint16_t ackBusyFlag = 0b1010101001010101;  // An ACK sent while the write queue is above its high-water mark
+const uint16_t ackExtFlag = 0b1010010110100101;   // An ACK in the versioned format (ACK_EXT_LEN bytes)
+const uint16_t probeFlag = 0b0000111100001111;    // A padded datagram probing if a size gets through, its sequence # is its length
+const uint16_t probeAckFlag = 0b1111000011110000; // The answer to a probe that arrived whole
+const uint16_t finAckFlag = 0b1100001111000011;   // The answer to a close carrying the length, once it has every byte
+const uint16_t connDataFlag = 0b0110011001100110;  // Data from a session with a connection ID (CONN_HDR_LEN header)
+const uint16_t connCloseFlag = 0b1001100110011001; // Close from a session with a connection ID (CONN_HDR_LEN header)
+
+/**
+ * checkpoint - how much of a session's byte range is on disk, saved in a file next to the
+ * output so an upload that was cut off can resume
+ * @magic: CKPT_MAGIC
+ * @offset: The file offset of the range's first byte
+ * @length: The length of the range, 0 if the client didn't know it
+ * @done: The bytes of the range written, from its first byte on without a gap
+ **/
+struct checkpoint {
+  uint64_t magic, offset, length, done;
+};
+
+/**
+ * writeQueue - payloads delivered in order, on their way from the receiving thread to the disk
+ * writer thread. A lock-free single producer / single consumer ring of payload buffers: the
+ * receiver copies each payload into the slot at head and publishes a batch of them by moving
+ * head, the writer writes the slots up to head with one pwritev call and frees them by moving
+ * tail. The lock is only taken to sleep when the ring is empty or full.
+ * @fd: The file descriptor of the file
+ * @offset: The file offset of the slot at tail (writer only)
+ * @ckpt: The session's checkpoint as last saved, its offset is where the session's range starts
+ * @ckptFd: The checkpoint file, -1 if the session keeps none
+ * @hashing: If the writer hashes the range as it writes it
+ * @hash: The FNV-1a 64 hash of the range up to offset (writer only, until it has stopped)
+ * @bufs: numSlots payload buffers of slotSize bytes
+ * @lens: The length of the payload in each slot
+ * @slotSize: The size of each payload buffer, the session's MSS
+ * @numSlots: The number of payload buffers, WRITE_QUEUE_SLOTS or as many as fit in WRITE_QUEUE_BYTES
+ * @head: The slot after the last one published by the receiver
+ * @tail: The slot after the last one written
+ * @filled: The slot after the last one filled by the receiver, published at the next writeFlush (receiver only)
+ * @highWater: The number of slots in use at which ACKs ask the client to slow down
+ * @done: The receiver has published its last payload
+ * @lock, @notEmpty, @notFull: Used to sleep when the ring is empty or full
+ * @thread: The session's disk writer thread
+ **/
+struct writeQueue {
+  int fd;
+  off_t offset;
+  struct checkpoint ckpt;
+  int ckptFd;
+  int hashing;
+  uint64_t hash;
+  u_char *bufs;
+  uint32_t *lens;
+  size_t slotSize;
+  uint32_t numSlots;
+  _Atomic uint64_t head;
+  _Atomic uint64_t tail;
+  uint64_t filled;
+  uint32_t highWater;
+  _Atomic int done;
+  pthread_mutex_t lock;
+  pthread_cond_t notEmpty, notFull;
+  pthread_t thread;
+};
+
+/**
+ * sessionStats - what happened to a session's datagrams, printed when it closes
+ * @datagrams: The datagrams received
+ * @bytes: The payload bytes delivered in order
+ * @outOfOrder: Datagrams that weren't the next in order (early, or repeats)
+ * @chkFails: Datagrams that failed checksum verification
+ * @dropped: Datagrams dropped by the artificial loss
+ **/
+struct sessionStats {
+  uint64_t datagrams, bytes, outOfOrder, chkFails, dropped;
+};
+
+/**
+ * session - the state of one client's transfer. Clients that asked for a connection ID in the
+ * handshake are found by the ID carried in each of their datagrams, other clients by their address.
+ * @key: The session's key in the session table
+ * @id: The session's ID, sent to the client as its connection ID when it asked for one
+ * @peer: Where the session's ACKs are sent, the address its last datagram came from
+ * @hdrLen: The length of the session's data headers, DATA_HDR_LEN or CONN_HDR_LEN
+ * @mss: The largest payload of the session's datagrams, agreed in the handshake
+ * @chkAlgo: The checksum covering the session's data, agreed in the handshake
+ * @isn: The sequence # of the session's first datagram, agreed in the handshake
+ * @resumeAt: The bytes of the session's range an earlier session left on disk, which the client skips
+ * @finished: The client's FIN said every byte arrived
+ * @finHash: The hash of the range the client sent in its FIN
+ * @hashRecvd: If the FIN carried a hash
+ * @seqExpected: The sequence # of the next datagram in order
+ * @lastACKseq: Go-Back-N only - the last sequence # ACK'd
+ * @numTimesFailed: Go-Back-N only - checksum failures since an ACK was last resent
+ * @mode: The transfer mode, MODE_GBN or MODE_SR
+ * @ackVersion: The ACK format the client was told it gets, 0 for the 8 byte ACK
+ * @reorderWinSize: Selective repeat only - the number of slots in the reorder ring
+ * @reorderDgrams: The reorder ring, the slot at reorderHead holds seqExpected
+ * @reorderLens: The size of the datagram in each slot, 0 if the slot is empty
+ * @reorderHead: The slot of seqExpected
+ * @charged: The bytes of MEMORY_BUDGET_BYTES the session's write queue, writer stack and reorder ring hold (sessionsLock)
+ * @windowBytes: The bytes of the worker's socket buffer a full window of the session's datagrams takes
+ * @path: The output file
+ * @xfer: The transfer the session is a stream of
+ * @fd: The file descriptor of the output file
+ * @writer: The payloads on their way to the output file
+ * @lastHeard: The monotonic time in seconds the last datagram arrived
+ * @stats: What happened to the session's datagrams
+ * @next: The next session in the same bucket of the session table
+ * @nextAll: The next session in the list of every session
+ **/
+struct session {
+  uint64_t key;
+  uint32_t id;
+  struct sockaddr_in peer;
+  size_t hdrLen;
+  size_t mss;
+  int chkAlgo;
+  uint32_t isn;
+  uint64_t resumeAt;
+  int finished;
+  uint64_t finHash;
+  int hashRecvd;
+  uint32_t seqExpected;
+  uint32_t lastACKseq;
+  int numTimesFailed;
+  int mode;
+  int ackVersion;
+  uint32_t reorderWinSize;
+  u_char **reorderDgrams;
+  ssize_t *reorderLens;
+  uint32_t reorderHead;
+  size_t charged;
+  size_t windowBytes;
+  char path[PATH_MAX];
+  struct transfer *xfer;
+  int fd;
+  struct writeQueue writer;
+  time_t lastHeard;
+  struct sessionStats stats;
+  struct session *next;
+  struct session *nextAll;
+};
+
+/**
+ * transfer - a file the sessions of one client write: its one stream, or every stream it split
+ * the file into (-P). It outlives its sessions until every stream has joined, so a stream can
+ * still join once the first one has finished, and the checkpoints of its streams are kept until
+ * each of them has finished.
+ * @id: The ID of the first stream's session, which the other streams join
+ * @path: The output file
+ * @numStreams: The streams the client said it splits the file into
+ * @joined: The streams that have joined, the first included
+ * @finished: The streams whose client finished
+ * @open: The sessions still open
+ * @ckptOffsets: The offset of the range of each stream keeping a checkpoint, which names it
+ * @numCkpts: The streams keeping a checkpoint
+ * @expires: The monotonic time in seconds it stops waiting for streams to join, once no session is open
+ * @next: The next transfer in the list of every transfer
+ *
+ * Note: sessionsLock must be held to use any transfer
+ **/
+struct transfer {
+  uint32_t id;
+  char path[PATH_MAX];
+  uint32_t numStreams;
+  uint32_t joined, finished, open;
+  uint64_t *ckptOffsets;
+  uint32_t numCkpts;
+  time_t expires;
+  struct transfer *next;
+};
+
+uint32_t highWater;                              // Queued payloads at which ACKs ask the client to slow down
+char *outputName;                                // The server's file-name: a file, or a directory to write into
+struct impairConfig impairCfg;                   // The artificial loss, duplication and corruption of received datagrams
+int keepServing = 0;                             // If the server outlives its sessions
+int numWorkers = 1;                              // The receiver threads, each with its own socket
+pthread_mutex_t sessionsLock = PTHREAD_MUTEX_INITIALIZER;  // Held while any worker opens or closes a session
+int numSessions = 0;                             // The open sessions of every worker (sessionsLock)
+size_t memoryCharged = 0;                        // The bytes of MEMORY_BUDGET_BYTES the open sessions hold (sessionsLock)
+_Atomic uint64_t sessionsServed = 0;             // The sessions started, the server exits once they all close
+struct transfer *transfers = NULL;               // Every transfer with a session open or waiting for streams (sessionsLock)
+_Atomic int openTransfers = 0;                   // The transfers in the list, read without the lock
+cpu_set_t allCpus;                               // The cores the server may run on, for the writer threads
+
+/**
+ * dgramBatch - datagrams received with one recvmmsg call, or ACKs queued for one sendmmsg call
+ * @msgs: The message of each datagram
+ * @iovs: The buffer of each datagram
+ * @addrs: The client each datagram came from or is sent to
+ * @ctrls: The segment size the kernel reports for coalesced datagrams
+ * @bufs: RECV_BATCH buffers of bufSize bytes each
+ * @bufSize: The size of each buffer
+ * @count: The number of datagrams in the batch
+ **/
+struct dgramBatch {
+  struct mmsghdr msgs[RECV_BATCH];
+  struct iovec iovs[RECV_BATCH];
+  struct sockaddr_in addrs[RECV_BATCH];
+  char ctrls[RECV_BATCH][CMSG_SPACE(sizeof(int))];
+  u_char *bufs;
+  size_t bufSize;
+  int count;
+};
+
+/**
+ * rcvdSegment - one datagram of a received batch. With UDP_GRO one message may hold several.
+ * @dgram: The start of the datagram in its message's buffer
+ * @len: The length of the datagram
+ * @addr: The client the datagram came from
+ * @impaired: 1 if the datagram already went through the artificial impairment, as a duplicate does
+ **/
+struct rcvdSegment {
+  u_char *dgram;
+  ssize_t len;
+  struct sockaddr_in *addr;
+  int impaired;
+};
+
+/**
+ * worker - a receiver thread. Each worker has its own socket bound to the port (SO_REUSEPORT)
+ * and owns the sessions of the clients the kernel steers to it, so workers share nothing on
+ * the receive path.
+ * @index: The worker's index, also its socket's place in the port's reuseport group
+ * @sockfd: The worker's socket
+ * @thread: The worker's thread
+ * @impair: The worker's stream of artificial impairment decisions
+ * @nextIdBase: Session IDs are nextIdBase * numWorkers + index, so an ID names its worker
+ * @sessionTable: The worker's sessions by key, chained
+ * @allSessions: Every open session of the worker (changed with sessionsLock held)
+ * @recvd: Datagrams taken from each recvmmsg call
+ * @recvBufSize: The size the buffers of recvd grow to after the batch, to fit the largest MSS agreed
+ * @windowBytes: The full windows of every open session added up, which all arrive on the one socket
+ * @sockBufSize: The socket's receive buffer, the kernel's default until it is grown to hold windowBytes
+ * @acks: ACKs sent together after each batch is processed
+ * @segs: The datagrams of each batch
+ **/
+struct worker {
+  int index;
+  int sockfd;
+  pthread_t thread;
+  struct impairState impair;
+  uint32_t nextIdBase;
+  struct session *sessionTable[SESSION_BUCKETS];
+  struct session *allSessions;
+  struct dgramBatch recvd;
+  size_t recvBufSize;
+  size_t windowBytes;
+  int sockBufSize;
+  struct dgramBatch acks;
+  struct rcvdSegment segs[RECV_BATCH * GRO_MAX_SEGS];
+};
 
-FILE *fileToWrite;
+struct worker *workers;
 
 /**
  * error - prints the value of errno & exit
@@ -58,118 +383,1080 @@ void printDGram(u_char *dGram, int dGramLen, uint8_t withIndicies)
 }
 
 /**
- * clearBuffers - Clears the datagram buffers
- * recvdDatagram: The buffer for receiving datagrams
- * ackDatagram: The buffer for sending ACK datagrams
+ * writerCheckpoint - saves how much of a session's range is on disk. The data is synced first,
+ * so the checkpoint never claims more than a crash would leave.
+ * @queue: The session's write queue, used by its writer thread or once that has stopped
+ **/
+void writerCheckpoint(struct writeQueue *queue)
+{
+  fdatasync(queue->fd);
+  queue->ckpt.done = queue->offset - queue->ckpt.offset;
+  if(pwrite(queue->ckptFd, &queue->ckpt, sizeof(queue->ckpt), 0) != sizeof(queue->ckpt))
+    printf("Error saving a checkpoint\n");
+}
+
+/**
+ * writerRehash - hashes the part of a resumed session's range an earlier session wrote, read
+ * back from the file, so the hash covers what is on disk
+ * @queue: The session's write queue, whose hash is continued
+ **/
+void writerRehash(struct writeQueue *queue)
+{
+  u_char *buf = (u_char*) malloc(REHASH_BUF_SIZE);
+  off_t off = queue->ckpt.offset;
+  ssize_t numRead;
+
+  if(buf == NULL) error("Rehash memory allocation failure\n");
+  while(off < queue->offset) {
+    numRead = pread(queue->fd, buf, queue->offset - off < REHASH_BUF_SIZE ? queue->offset - off : REHASH_BUF_SIZE, off);
+    if(numRead < 0 && errno == EINTR) continue;
+    if(numRead <= 0) break;   // Shorter than the checkpoint says, the hash won't match
+    queue->hash = fnv1a64(queue->hash, buf, numRead);
+    off += numRead;
+  }
+  free(buf);
+}
+
+/**
+ * writerThread - the disk writer of one session: writes every published payload at its file
+ * offset, as many as fit in one pwritev call at a time, until the session is done. Every
+ * CHECKPOINT_BYTES the session's checkpoint is saved.
+ * @arg: The session's write queue
+ *
+ * Note: a short write is continued from the first byte not written
+ **/
+void *writerThread(void *arg)
+{
+  struct writeQueue *queue = (struct writeQueue*) arg;
+  struct iovec iovs[WRITE_BATCH], *iov;
+  uint64_t tail = atomic_load_explicit(&queue->tail, memory_order_relaxed), head;
+  int count;
+  ssize_t written;
+
+  if(queue->hashing && queue->ckpt.done > 0) writerRehash(queue);
+
+  while(1) {
+    head = atomic_load_explicit(&queue->head, memory_order_acquire);
+    if(head == tail) {
+      if(atomic_load(&queue->done)) break;
+      pthread_mutex_lock(&queue->lock);
+      while(atomic_load(&queue->head) == tail && !atomic_load(&queue->done))
+        pthread_cond_wait(&queue->notEmpty, &queue->lock);
+      pthread_mutex_unlock(&queue->lock);
+      continue;
+    }
+
+    for(count = 0; count < WRITE_BATCH && tail + count < head; count++) {
+      iovs[count].iov_base = queue->bufs + ((tail + count) % queue->numSlots) * queue->slotSize;
+      iovs[count].iov_len = queue->lens[(tail + count) % queue->numSlots];
+      if(queue->hashing) queue->hash = fnv1a64(queue->hash, iovs[count].iov_base, iovs[count].iov_len);
+    }
+    tail += count;
+
+    for(iov = iovs; count > 0; ) {
+      written = pwritev(queue->fd, iov, count, queue->offset);
+      if(written < 0 && errno == EINTR) continue;
+      if(written < 0) error("Error writing the file");
+      queue->offset += written;
+
+      while(count > 0 && (size_t) written >= iov->iov_len) {
+        written -= iov->iov_len;
+        iov++;
+        count--;
+      }
+      if(count > 0) {
+        iov->iov_base = (u_char*) iov->iov_base + written;
+        iov->iov_len -= written;
+      }
+    }
+
+    atomic_store_explicit(&queue->tail, tail, memory_order_release);
+    pthread_mutex_lock(&queue->lock);
+    pthread_cond_signal(&queue->notFull);
+    pthread_mutex_unlock(&queue->lock);
+
+    if(queue->ckptFd >= 0 && (uint64_t) (queue->offset - queue->ckpt.offset) - queue->ckpt.done >= CHECKPOINT_BYTES)
+      writerCheckpoint(queue);
+  }
+  return NULL;
+}
+
+/**
+ * writeQueueSlots - the number of payload buffers in a session's write queue
+ * @mss: The session's MSS, the size of each buffer
+ *
+ * Return: uint32_t - WRITE_QUEUE_SLOTS, or as many as fit in WRITE_QUEUE_BYTES
+ **/
+uint32_t writeQueueSlots(size_t mss)
+{
+  return WRITE_QUEUE_BYTES / mss < WRITE_QUEUE_SLOTS ? WRITE_QUEUE_BYTES / mss : WRITE_QUEUE_SLOTS;
+}
+
+/**
+ * writeQueueCharge - the memory a session's write queue and writer thread hold
+ * @mss: The session's MSS
+ *
+ * Return: size_t - the bytes charged to MEMORY_BUDGET_BYTES
+ **/
+size_t writeQueueCharge(size_t mss)
+{
+  size_t numSlots = writeQueueSlots(mss);
+
+  return ((numSlots * mss + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1)) + numSlots * sizeof(uint32_t) + WRITER_STACK_BYTES;
+}
+
+/**
+ * writerInit - allocates a write queue and starts its disk writer thread
+ * @queue: The write queue being started
+ * @fd: The file descriptor of the file
+ * @mark: The number of slots in use, out of WRITE_QUEUE_SLOTS, at which ACKs ask the client to
+ * slow down. A queue with fewer slots is marked at the same fraction.
+ * @mss: The largest payload
+ * @ckpt: The session's range and how much of it is already on disk, the first payload is
+ * written after that
+ * @ckptFd: The session's checkpoint file, -1 for none
+ * @hashing: If the range is hashed
+ **/
+void writerInit(struct writeQueue *queue, int fd, uint32_t mark, size_t mss, const struct checkpoint *ckpt,
+    int ckptFd, int hashing)
+{
+  pthread_attr_t attr;
+
+  memset(queue, 0, sizeof(*queue));
+  queue->fd = fd;
+  queue->ckpt = *ckpt;
+  queue->ckptFd = ckptFd;
+  queue->offset = ckpt->offset + ckpt->done;
+  queue->hashing = hashing;
+  queue->hash = FNV64_OFFSET;
+  queue->slotSize = mss;
+  queue->numSlots = writeQueueSlots(mss);
+  queue->highWater = (uint64_t) mark * queue->numSlots / WRITE_QUEUE_SLOTS;
+  if(queue->highWater == 0) queue->highWater = 1;
+  queue->bufs = (u_char*) aligned_alloc(ARENA_ALIGN,
+      (queue->numSlots * queue->slotSize + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1));
+  queue->lens = (uint32_t*) malloc(queue->numSlots * sizeof(*queue->lens));
+  if(queue->bufs == NULL || queue->lens == NULL) error("Write queue memory allocation failure\n");
+  pthread_mutex_init(&queue->lock, NULL);
+  pthread_cond_init(&queue->notEmpty, NULL);
+  pthread_cond_init(&queue->notFull, NULL);
+
+  // Writers may run on any core, not only on the core of the pinned worker starting them
+  pthread_attr_init(&attr);
+  pthread_attr_setaffinity_np(&attr, sizeof(allCpus), &allCpus);
+  pthread_attr_setstacksize(&attr, WRITER_STACK_BYTES);
+  if(pthread_create(&queue->thread, &attr, writerThread, queue) != 0) error("Error starting the writer thread");
+  pthread_attr_destroy(&attr);
+}
+
+/**
+ * writeFlush - publishes the payloads filled since the last call to the disk writer
+ * @queue: The session's write queue
+ **/
+void writeFlush(struct writeQueue *queue)
+{
+  if(queue->filled == atomic_load_explicit(&queue->head, memory_order_relaxed)) return;
+  atomic_store_explicit(&queue->head, queue->filled, memory_order_release);
+  pthread_mutex_lock(&queue->lock);
+  pthread_cond_signal(&queue->notEmpty);
+  pthread_mutex_unlock(&queue->lock);
+}
+
+/**
+ * writePayload - copies the payload of the next datagram in order into the write queue. If the
+ * queue is full the receiver waits for the writer, which only happens once ACKs have been
+ * asking the client to slow down since the high-water mark.
+ * @queue: The session's write queue
+ * @data: The payload
+ * @len: The length of the payload
+ **/
+void writePayload(struct writeQueue *queue, const u_char *data, size_t len)
+{
+  if(len == 0) return;
+  if(queue->filled - atomic_load_explicit(&queue->tail, memory_order_acquire) == queue->numSlots) {
+    writeFlush(queue);
+    pthread_mutex_lock(&queue->lock);
+    while(queue->filled - atomic_load(&queue->tail) == queue->numSlots)
+      pthread_cond_wait(&queue->notFull, &queue->lock);
+    pthread_mutex_unlock(&queue->lock);
+  }
+
+  memcpy(queue->bufs + (queue->filled % queue->numSlots) * queue->slotSize, data, len);
+  queue->lens[queue->filled % queue->numSlots] = len;
+  queue->filled++;
+}
+
+/**
+ * writerBusy - if a write queue is at or above its high-water mark
+ * @queue: The session's write queue
+ *
+ * Return: int - 1 if the client should slow down, 0 otherwise
+ **/
+int writerBusy(struct writeQueue *queue)
+{
+  return queue->filled - atomic_load_explicit(&queue->tail, memory_order_relaxed) >= queue->highWater;
+}
+
+/**
+ * writerClose - publishes the last payloads and waits for the writer thread to write them
+ * @queue: The session's write queue
+ **/
+void writerClose(struct writeQueue *queue)
+{
+  writeFlush(queue);
+  pthread_mutex_lock(&queue->lock);
+  atomic_store(&queue->done, 1);
+  pthread_cond_signal(&queue->notEmpty);
+  pthread_mutex_unlock(&queue->lock);
+  pthread_join(queue->thread, NULL);
+  pthread_mutex_destroy(&queue->lock);
+  pthread_cond_destroy(&queue->notEmpty);
+  pthread_cond_destroy(&queue->notFull);
+  free(queue->bufs);
+  free(queue->lens);
+}
+
+/**
+ * nowSec - the current time of the monotonic clock
+ *
+ * Return: time_t - seconds
+ **/
+time_t nowSec(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec;
+}
+
+/**
+ * addrKey - the session table key of a client without a connection ID
+ * @addr: The client's address
+ *
+ * Return: uint64_t - the key, never a connection ID since its top bit is set
+ **/
+uint64_t addrKey(struct sockaddr_in *addr)
+{
+  return (1ULL << 63) | ((uint64_t) ntohl(addr->sin_addr.s_addr) << 16) | ntohs(addr->sin_port);
+}
+
+/**
+ * samePeer - if two addresses are the same client
+ * @a: The first address
+ * @b: The second address
+ *
+ * Return: int - 1 if the IP address and port match, 0 otherwise
+ **/
+int samePeer(struct sockaddr_in *a, struct sockaddr_in *b)
+{
+  return a->sin_addr.s_addr == b->sin_addr.s_addr && a->sin_port == b->sin_port;
+}
+
+/**
+ * sessionBucket - the bucket of a worker's session table a key is chained in
+ * @w: The worker
+ * @key: The session's key
+ *
+ * Return: struct session** - the head of the bucket's chain
+ **/
+struct session **sessionBucket(struct worker *w, uint64_t key)
+{
+  return &w->sessionTable[(key * 0x9E3779B97F4A7C15ULL) >> 56 & (SESSION_BUCKETS - 1)];
+}
+
+/**
+ * findSession - looks a session of a worker up by its key
+ * @w: The worker
+ * @key: The connection ID, or addrKey() of the client
+ *
+ * Return: struct session* - the session, NULL if there is none
+ **/
+struct session *findSession(struct worker *w, uint64_t key)
+{
+  struct session *sess;
+
+  for(sess = *sessionBucket(w, key); sess != NULL; sess = sess->next)
+    if(sess->key == key) return sess;
+  return NULL;
+}
+
+/**
+ * unlinkSession - takes a session out of its bucket of a worker's session table
+ * @w: The worker
+ * @sess: The session
+ **/
+void unlinkSession(struct worker *w, struct session *sess)
+{
+  struct session **link = sessionBucket(w, sess->key);
+
+  while(*link != sess) link = &(*link)->next;
+  *link = sess->next;
+}
+
+/**
+ * pathInUse - if a transfer, with a session of any worker open or still waiting for its
+ * streams, is writing to a file
+ * @path: The file
+ *
+ * Note: sessionsLock must be held
+ *
+ * Return: int - 1 if a transfer has the file, 0 otherwise
+ **/
+int pathInUse(const char *path)
+{
+  for(struct transfer *xfer = transfers; xfer != NULL; xfer = xfer->next)
+    if(strcmp(xfer->path, path) == 0) return 1;
+  return 0;
+}
+
+/**
+ * sessionPath - picks the file a new session is written to. When the server's file-name is a
+ * directory the file is the name the client gave, or upload.<id> if it gave none or the name
+ * isn't a plain file name. Otherwise it's the file-name itself. A file another session has open
+ * gets the session's ID appended.
+ *
+ * Note: sessionsLock must be held
+ * @sess: The new session, its path is set
+ * @name: The name the client gave in the handshake, NULL if none
+ * @nameLen: The length of the name
+ **/
+void sessionPath(struct session *sess, const u_char *name, size_t nameLen)
+{
+  struct stat st;
+  int validName = name != NULL && nameLen > 0 && nameLen <= NAME_MAX &&
+      memchr(name, '/', nameLen) == NULL && memchr(name, '\0', nameLen) == NULL &&
+      !(nameLen == 1 && name[0] == '.') && !(nameLen == 2 && name[0] == '.' && name[1] == '.');
+  size_t len;
+
+  if(stat(outputName, &st) == 0 && S_ISDIR(st.st_mode)) {
+    if(validName) snprintf(sess->path, sizeof(sess->path), "%s/%.*s", outputName, (int) nameLen, (const char*) name);
+    else snprintf(sess->path, sizeof(sess->path), "%s/upload.%u", outputName, sess->id);
+  } else {
+    snprintf(sess->path, sizeof(sess->path), "%s", outputName);
+  }
+
+  if(pathInUse(sess->path)) {
+    len = strlen(sess->path);
+    snprintf(sess->path + len, sizeof(sess->path) - len, ".%u", sess->id);
+  }
+}
+
+/**
+ * ringSlotCharge - the memory each slot of a reorder ring holds
+ * @slotSize: The size of the session's datagrams, its MSS and header
+ *
+ * Return: size_t - the bytes charged to MEMORY_BUDGET_BYTES
+ **/
+size_t ringSlotCharge(size_t slotSize)
+{
+  return slotSize + sizeof(u_char*) + sizeof(ssize_t);
+}
+
+/**
+ * grantWindow - the window a session is granted, the size of its reorder ring
+ * @mode: The mode the client asked for
+ * @window: The client's window
+ * @slotSize: The size of the session's datagrams, its MSS and header
+ * @avail: The bytes of MEMORY_BUDGET_BYTES left for the reorder ring
+ *
+ * Return: uint32_t - the window, 0 if the session is left in go-back-n
+ **/
+uint32_t grantWindow(uint64_t mode, uint64_t window, size_t slotSize, size_t avail)
+{
+  if(mode != MODE_SR) return 0;
+  if(window > MAX_SR_WINDOW) window = MAX_SR_WINDOW;
+  if(window > MAX_REORDER_BYTES / slotSize) window = MAX_REORDER_BYTES / slotSize;
+  if(window > avail / ringSlotCharge(slotSize)) window = avail / ringSlotCharge(slotSize);
+  return window;
+}
+
+/**
+ * sessionSetMode - sets the transfer mode of a session, allocating its reorder ring for
+ * selective repeat
+ * @sess: The session, which has no data yet
+ * @window: The window granted by grantWindow, the size of the reorder ring, 0 for go-back-n
+ **/
+void sessionSetMode(struct session *sess, uint32_t window)
+{
+  size_t slotSize = sess->mss + sess->hdrLen;
+
+  if(window == 0) return;
+
+  sess->mode = MODE_SR;
+  sess->reorderWinSize = window;
+  sess->reorderDgrams = (u_char**) malloc(window * sizeof(*sess->reorderDgrams));
+  sess->reorderLens = (ssize_t*) calloc(window, sizeof(*sess->reorderLens));
+  if(sess->reorderDgrams == NULL || sess->reorderLens == NULL) error("Reorder ring memory allocation failure\n");
+  for(uint32_t i = 0; i < window; i++) {
+    sess->reorderDgrams[i] = (u_char*) malloc(slotSize);
+    if(sess->reorderDgrams[i] == NULL) error("Reorder ring memory allocation failure\n");
+  }
+}
+
+/**
+ * sessionFreeRing - frees the reorder ring of a session, which is left in go-back-n, and gives
+ * its memory back to the budget
+ * @sess: The session
+ **/
+void sessionFreeRing(struct session *sess)
+{
+  size_t ringBytes = sess->reorderWinSize * ringSlotCharge(sess->mss + sess->hdrLen);
+
+  if(ringBytes > 0) {
+    pthread_mutex_lock(&sessionsLock);
+    memoryCharged -= ringBytes;
+    sess->charged -= ringBytes;
+    pthread_mutex_unlock(&sessionsLock);
+  }
+  for(uint32_t i = 0; i < sess->reorderWinSize; i++) free(sess->reorderDgrams[i]);
+  free(sess->reorderDgrams);
+  free(sess->reorderLens);
+  sess->reorderDgrams = NULL;
+  sess->reorderLens = NULL;
+  sess->reorderWinSize = 0;
+  sess->mode = MODE_GBN;
+}
+
+/**
+ * synRequest - what a client asked for in its SYN, all 0 for a client without the handshake
+ * @mode: The transfer mode
+ * @window: The client's window
+ * @name: The name the client gave for its file, NULL if none
+ * @nameLen: The length of the name
+ * @joinId: The connection ID of the session whose file the client writes a byte range of, 0 if none
+ * @offset: The file offset of the byte range
+ * @ackVersion: The newest ACK format the client reads
+ * @mss: The client's MSS, 0 for LEGACY_MSS
+ * @chkAlgo: The checksum the client asked for
+ * @isn: The sequence # of the client's first datagram
+ * @length: The number of bytes the client will send, 0 if it doesn't know
+ * @resume: If the client asks to resume from what an earlier session left on disk
+ * @hash: The hash the client will send in its FIN, 0 for none
+ * @streams: The streams the client splits its file into, 0 if it didn't say
+ **/
+struct synRequest {
+  uint64_t mode, window;
+  const u_char *name;
+  size_t nameLen;
+  uint64_t joinId, offset;
+  uint64_t ackVersion;
+  uint64_t mss;
+  uint64_t chkAlgo, isn, length;
+  uint64_t resume, hash;
+  uint64_t streams;
+};
+
+/**
+ * checkpointPath - the checkpoint file of a session: the output's name followed by .ckpt, and the
+ * offset of the session's range when it doesn't start the file
+ * @buf: Set to the name
+ * @bufSize: The size of buf
+ * @path: The session's output file
+ * @offset: The file offset of the session's range
+ **/
+void checkpointPath(char *buf, size_t bufSize, const char *path, uint64_t offset)
+{
+  if(offset == 0) snprintf(buf, bufSize, "%s.ckpt", path);
+  else snprintf(buf, bufSize, "%s.ckpt.%lu", path, (unsigned long) offset);
+}
+
+/**
+ * findTransfer - looks up a transfer by the ID of its first stream's session
+ * @id: The session's ID
+ *
+ * Note: sessionsLock must be held
+ *
+ * Return: struct transfer* - the transfer, NULL if there is none
+ **/
+struct transfer *findTransfer(uint32_t id)
+{
+  for(struct transfer *xfer = transfers; xfer != NULL; xfer = xfer->next)
+    if(xfer->id == id) return xfer;
+  return NULL;
+}
+
+/**
+ * transferOpen - starts the transfer of a session that starts a file
+ * @sess: The first stream's session, whose path is set
+ * @numStreams: The streams the client splits the file into, 0 if it didn't say
+ *
+ * Note: sessionsLock must be held
+ *
+ * Return: struct transfer* - the transfer
+ **/
+struct transfer *transferOpen(struct session *sess, uint64_t numStreams)
+{
+  struct transfer *xfer = (struct transfer*) calloc(1, sizeof(*xfer));
+
+  if(xfer == NULL) error("Transfer memory allocation failure\n");
+  xfer->id = sess->id;
+  memcpy(xfer->path, sess->path, sizeof(xfer->path));
+  xfer->numStreams = numStreams > 1 ? numStreams : 1;
+  xfer->next = transfers;
+  transfers = xfer;
+  atomic_fetch_add(&openTransfers, 1);
+  return xfer;
+}
+
+/**
+ * transferEnd - ends a transfer with no session open. Once every stream has finished the
+ * checkpoints of its streams are removed, otherwise they are kept for the client to resume from.
+ * @xfer: The transfer
+ *
+ * Note: sessionsLock must be held
+ **/
+void transferEnd(struct transfer *xfer)
+{
+  struct transfer **link = &transfers;
+  char path[PATH_MAX + 32];
+
+  if(xfer->finished >= xfer->numStreams && xfer->finished == xfer->joined) {
+    for(uint32_t i = 0; i < xfer->numCkpts; i++) {
+      checkpointPath(path, sizeof(path), xfer->path, xfer->ckptOffsets[i]);
+      unlink(path);
+    }
+  } else if(xfer->joined < xfer->numStreams) {
+    printf("Transfer of %s: %u of %u streams joined, keeping its checkpoints\n", xfer->path, xfer->joined, xfer->numStreams);
+  }
+
+  while(*link != xfer) link = &(*link)->next;
+  *link = xfer->next;
+  atomic_fetch_sub(&openTransfers, 1);
+  free(xfer->ckptOffsets);
+  free(xfer);
+}
+
+/**
+ * transferLeave - takes a closing session off its transfer, which ends once its last session
+ * has closed and every stream has joined. A transfer still waiting for streams ends when they
+ * haven't joined SESSION_IDLE_SEC later.
+ * @xfer: The transfer
+ * @finished: If the session's client finished
+ *
+ * Note: sessionsLock must be held
+ **/
+void transferLeave(struct transfer *xfer, int finished)
+{
+  xfer->open--;
+  xfer->finished += finished;
+  if(xfer->open > 0) return;
+  if(xfer->joined < xfer->numStreams) xfer->expires = nowSec() + SESSION_IDLE_SEC;
+  else transferEnd(xfer);
+}
+
+/**
+ * reapTransfers - ends every transfer with no session open whose streams haven't all joined in time
+ * @now: The current monotonic time in seconds
  **/
-void clearBuffers(u_char *recvdDatagram, u_char *ackDatagram) 
+void reapTransfers(time_t now)
 {
-  memset(recvdDatagram, 0, BUFFER_SIZE);    
-  memset(ackDatagram, 0, ACK_DGRAM_SIZE);    
+  struct transfer *xfer, *next;
+
+  pthread_mutex_lock(&sessionsLock);
+  for(xfer = transfers; xfer != NULL; xfer = next) {
+    next = xfer->next;
+    if(xfer->open == 0 && now >= xfer->expires) transferEnd(xfer);
+  }
+  pthread_mutex_unlock(&sessionsLock);
 }
 
 /**
- * calcChecksum - calculate the checksum of the datagram to be sent
- * @nbytes: The number of bytes in the buffer
- * @sum: The variable to hold the checksum during computing
+ * sessionCheckpoint - opens the checkpoint file of a session that did the handshake. A client
+ * resuming its upload skips what the checkpoint says is on disk, if it was saved for the same
+ * byte range and the file is still that long. Otherwise the session starts at the range's first
+ * byte, and a session starting the file truncates it.
+ * @sess: The new session, whose file is open
+ * @req: What the client asked for
+ * @ckpt: Set to the session's range and the bytes of it on disk
+ * @startsFile: If the session starts the file rather than joining a session writing it
  *
- * Return: uint16_t - The checksum calculated
+ * Return: int - the checkpoint file, -1 if it couldn't be opened
  **/
-uint16_t calcChecksum(unsigned char *buf, unsigned nbytes, uint32_t sum)
+int sessionCheckpoint(struct session *sess, const struct synRequest *req, struct checkpoint *ckpt, int startsFile)
 {
-  uint i;
+  char path[PATH_MAX + 32];
+  struct checkpoint saved;
+  struct stat st;
+  int fd;
 
-  // Checksum all the pairs of bytes first...
-  for (i = 0; i < (nbytes & ~1U); i += 2) {
-    sum += (uint16_t)ntohs(*((uint16_t *)(buf + i)));
-    if (sum > 0xFFFF)
-      sum -= 0xFFFF;
+  ckpt->magic = CKPT_MAGIC;
+  ckpt->offset = req->offset;
+  ckpt->length = req->length;
+  ckpt->done = 0;
+
+  checkpointPath(path, sizeof(path), sess->path, req->offset);
+  fd = open(path, O_RDWR | O_CREAT, 0666);
+  if(req->resume && fd >= 0 && pread(fd, &saved, sizeof(saved), 0) == sizeof(saved) && saved.magic == CKPT_MAGIC &&
+      saved.offset == ckpt->offset && saved.length == ckpt->length && (saved.length == 0 || saved.done <= saved.length) &&
+      fstat(sess->fd, &st) == 0 && (uint64_t) st.st_size >= saved.offset + saved.done) {
+    ckpt->done = saved.done;
+  } else if(req->resume && startsFile && ftruncate(sess->fd, 0) < 0) {
+    error("Error truncating the file\n");
   }
 
-  /*
-   * If there's a single byte left over, checksum it, too.
-   * Network byte order is big-endian, so the remaining byte is
-   * the high byte.
-   */
-  if (i < nbytes) {
-    sum += buf[i] << 8;
-    if (sum > 0xFFFF)
-      sum -= 0xFFFF;
+  if(fd >= 0 && pwrite(fd, ckpt, sizeof(*ckpt), 0) != sizeof(*ckpt)) printf("Error saving a checkpoint\n");
+  return fd;
+}
+
+/**
+ * sessionOpen - starts a session of a worker: opens its file and starts its writer thread. A
+ * session joining a transfer writes its byte range into the transfer's file.
+ * @w: The worker the session belongs to
+ * @key: The session's key, 0 to key it by the connection ID it is given
+ * @peer: The client
+ * @req: What the client asked for
+ *
+ * Return: struct session* - the session, NULL if MAX_SESSIONS are already open, its write queue
+ * doesn't fit in what's left of MEMORY_BUDGET_BYTES or the transfer to join has ended
+ **/
+struct session *sessionOpen(struct worker *w, uint64_t key, struct sockaddr_in *peer, const struct synRequest *req)
+{
+  struct session *sess, **bucket;
+  struct transfer *joined = NULL;
+  struct checkpoint ckpt;
+  int ckptFd = -1;
+  size_t queueBytes;
+  uint32_t window = 0;
+
+  sess = (struct session*) calloc(1, sizeof(*sess));
+  if(sess == NULL) error("Session memory allocation failure\n");
+
+  // The base wraps before the ID would, an ID taken mod numWorkers is always the worker's index
+  if(w->nextIdBase == 0 || w->nextIdBase > (UINT32_MAX - w->index) / numWorkers) w->nextIdBase = 1;
+  sess->id = w->nextIdBase++ * numWorkers + w->index;
+  sess->key = key != 0 ? key : sess->id;
+  sess->hdrLen = key != 0 ? DATA_HDR_LEN : CONN_HDR_LEN;
+  sess->peer = *peer;
+  sess->isn = req->isn;
+  sess->seqExpected = sess->isn;
+  sess->lastACKseq = sess->isn - 1;  // The sequence # before the first until the first datagram is ACK'd
+  sess->chkAlgo = req->chkAlgo == CHK_NONE ? CHK_NONE : CHK_INET16;
+  sess->mode = MODE_GBN;
+  sess->lastHeard = nowSec();
+  sess->ackVersion = req->ackVersion < ACK_VERSION ? req->ackVersion : ACK_VERSION;
+  sess->mss = req->mss == 0 ? LEGACY_MSS : (req->mss < MAX_MSS ? req->mss : MAX_MSS);
+  queueBytes = writeQueueCharge(sess->mss);
+
+  pthread_mutex_lock(&sessionsLock);
+  if(req->joinId != 0) joined = findTransfer(req->joinId);
+  if(numSessions >= MAX_SESSIONS || (req->joinId != 0 && joined == NULL) || memoryCharged + queueBytes > MEMORY_BUDGET_BYTES) {
+    pthread_mutex_unlock(&sessionsLock);
+    if(req->joinId != 0 && joined == NULL) printf("No session %u to join, ignoring a new client\n", (uint32_t) req->joinId);
+    else if(numSessions >= MAX_SESSIONS) printf("Too many sessions, ignoring a new client\n");
+    else printf("Out of memory for sessions, ignoring a new client\n");
+    free(sess);
+    return NULL;
   }
+  // The reorder ring gets what's left of the budget once the write queue is charged, a window
+  // that doesn't fit is shrunk to one that does
+  window = grantWindow(req->mode, req->window, sess->mss + sess->hdrLen, MEMORY_BUDGET_BYTES - memoryCharged - queueBytes);
+  sess->charged = queueBytes + window * ringSlotCharge(sess->mss + sess->hdrLen);
+  memoryCharged += sess->charged;
+  // A joining stream shares the file, which its first stream already created and truncated, even
+  // if that stream has finished since. The file is opened for reading too, a resumed session
+  // hashes what is already on disk.
+  if(joined != NULL) {
+    memcpy(sess->path, joined->path, sizeof(sess->path));
+    sess->fd = open(sess->path, O_RDWR);
+    sess->xfer = joined;
+  } else {
+    // A file being resumed is only truncated once its checkpoint turns out not to fit
+    sessionPath(sess, req->name, req->nameLen);
+    sess->fd = open(sess->path, O_RDWR | O_CREAT | (req->resume ? 0 : O_TRUNC), 0666);
+    sess->xfer = transferOpen(sess, req->streams);
+  }
+  if(sess->fd < 0) error("Error opening the file\n");
+  sess->xfer->joined++;
+  sess->xfer->open++;
+  if(key == 0) {
+    sess->xfer->ckptOffsets = (uint64_t*) realloc(sess->xfer->ckptOffsets, (sess->xfer->numCkpts + 1) * sizeof(uint64_t));
+    if(sess->xfer->ckptOffsets == NULL) error("Transfer memory allocation failure\n");
+    sess->xfer->ckptOffsets[sess->xfer->numCkpts++] = req->offset;
+  }
+  sess->nextAll = w->allSessions;
+  w->allSessions = sess;
+  numSessions++;
+  atomic_fetch_add(&sessionsServed, 1);
+  pthread_mutex_unlock(&sessionsLock);
+  sessionSetMode(sess, window);
+
+  // Reserving the blocks up front keeps the file from fragmenting as the writer extends it. The size
+  // is kept so an unfinished upload isn't padded out, and a file system that can't reserve is left as is.
+  if(req->length > 0) fallocate(sess->fd, FALLOC_FL_KEEP_SIZE, req->offset, req->length);
 
-  return (sum);
+  // A client with a connection ID did the handshake, so it can come back for its session's range
+  ckpt = (struct checkpoint) { CKPT_MAGIC, req->offset, req->length, 0 };
+  if(key == 0) ckptFd = sessionCheckpoint(sess, req, &ckpt, joined == NULL);
+  sess->resumeAt = ckpt.done;
+  writerInit(&sess->writer, sess->fd, highWater, sess->mss, &ckpt, ckptFd, req->hash == HASH_FNV1A64);
+  bucket = sessionBucket(w, sess->key);
+  sess->next = *bucket;
+  *bucket = sess;
+
+  printf("Session %u: %s:%u writing to %s at %lu (%s)\n", sess->id, inet_ntoa(peer->sin_addr), ntohs(peer->sin_port),
+      sess->path, (unsigned long) (req->offset + ckpt.done), sess->mode == MODE_SR ? "selective repeat" : "go-back-n");
+  if(ckpt.done > 0) printf("Session %u: resuming after the %lu bytes on disk\n", sess->id, (unsigned long) ckpt.done);
+  return sess;
 }
 
 /**
- * makeHeader - makes the header for the ACK datagram to be sent to the client
+ * sessionClose - ends a session: waits for its payloads to be written, saves its checkpoint,
+ * prints its stats, takes it off its transfer and frees it. The checkpoint of a session whose
+ * client finished is removed once every stream of its transfer has finished, any other
+ * session's is kept for the client to resume from.
+ * @w: The worker the session belongs to
+ * @sess: The session
+ * @reason: Why the session ended
+ *
+ * Return: int - 1 if the hash the client sent in its FIN matches the range written, 0 if it
+ * doesn't, -1 if there was none to check
+ **/
+int sessionClose(struct worker *w, struct session *sess, const char *reason)
+{
+  struct session **link = &w->allSessions;
+  int verdict = -1;
+
+  w->windowBytes -= sess->windowBytes;
+  // A finished stream of a split file saves its whole range as on disk, for when another stream
+  // is resumed. The checkpoint of a file sent as one stream is removed as soon as it finishes.
+  writerClose(&sess->writer);
+  if(sess->writer.ckptFd >= 0) {
+    if(!sess->finished || sess->xfer->numStreams > 1) writerCheckpoint(&sess->writer);
+    close(sess->writer.ckptFd);
+  }
+  if(sess->writer.hashing && sess->hashRecvd) {
+    verdict = sess->writer.hash == sess->finHash;
+    printf("Session %u: the hash of %s %s the client's\n", sess->id, sess->path, verdict ? "matches" : "DOES NOT match");
+  }
+  close(sess->fd);
+  printf("Session %u %s: %s, %lu bytes in order, %lu datagrams, %lu out of order, %lu failed checksum, %lu dropped\n",
+      sess->id, reason, sess->path, (unsigned long) sess->stats.bytes, (unsigned long) sess->stats.datagrams,
+      (unsigned long) sess->stats.outOfOrder, (unsigned long) sess->stats.chkFails, (unsigned long) sess->stats.dropped);
+
+  unlinkSession(w, sess);
+  sessionFreeRing(sess);
+  pthread_mutex_lock(&sessionsLock);
+  while(*link != sess) link = &(*link)->nextAll;
+  *link = sess->nextAll;
+  numSessions--;
+  memoryCharged -= sess->charged;
+  transferLeave(sess->xfer, sess->finished);
+  pthread_mutex_unlock(&sessionsLock);
+
+  free(sess);
+  return verdict;
+}
+
+/**
+ * addrSession - the session of a client sending datagrams without a connection ID, started if
+ * it has none
+ * @w: The worker the client's datagrams are steered to
+ * @addr: The client's address
+ *
+ * Return: struct session* - the session, NULL if it couldn't be started
+ **/
+struct session *addrSession(struct worker *w, struct sockaddr_in *addr)
+{
+  uint64_t key = addrKey(addr);
+  struct session *sess = findSession(w, key);
+
+  if(sess != NULL) return sess;
+
+  // A client that never got a SYN-ACK falls back to go-back-n with the old header, the session
+  // its SYN started is moved to its address
+  for(sess = w->allSessions; sess != NULL; sess = sess->nextAll) {
+    if(!samePeer(&sess->peer, addr) || sess->stats.datagrams > 0) continue;
+    unlinkSession(w, sess);
+    sess->key = key;
+    sess->next = *sessionBucket(w, key);
+    *sessionBucket(w, key) = sess;
+    sessionFreeRing(sess);
+    sess->hdrLen = DATA_HDR_LEN;
+    return sess;
+  }
+
+  struct synRequest none = {0};
+
+  return sessionOpen(w, key, addr, &none);
+}
+
+/**
+ * reapSessions - closes every session of a worker that hasn't sent a datagram in SESSION_IDLE_SEC
+ * @w: The worker
+ * @now: The current monotonic time in seconds
+ **/
+void reapSessions(struct worker *w, time_t now)
+{
+  struct session *sess = w->allSessions, *next;
+
+  for(; sess != NULL; sess = next) {
+    next = sess->nextAll;
+    if(now - sess->lastHeard > SESSION_IDLE_SEC) sessionClose(w, sess, "timed out");
+  }
+}
+
+/**
+ * batchInit - allocates the buffers of a batch and points each message at its buffer and address
+ * @batch: The batch being initialized
+ * @bufSize: The size of each datagram buffer
+ **/
+void batchInit(struct dgramBatch *batch, size_t bufSize)
+{
+  memset(batch, 0, sizeof(*batch));
+  batch->bufSize = bufSize;
+  batch->bufs = (u_char*) aligned_alloc(ARENA_ALIGN, (RECV_BATCH * bufSize + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1));
+  if(batch->bufs == NULL) error("Batch memory allocation failure\n");
+
+  for(int i = 0; i < RECV_BATCH; i++) {
+    batch->iovs[i].iov_base = batch->bufs + i * bufSize;
+    batch->iovs[i].iov_len = bufSize;
+    batch->msgs[i].msg_hdr.msg_iov = &batch->iovs[i];
+    batch->msgs[i].msg_hdr.msg_iovlen = 1;
+    batch->msgs[i].msg_hdr.msg_name = &batch->addrs[i];
+    batch->msgs[i].msg_hdr.msg_namelen = sizeof(batch->addrs[i]);
+  }
+}
+
+/**
+ * recvBatch - blocks until at least one datagram arrives or the socket's receive timeout passes,
+ * then takes every waiting datagram that fits in the batch with the same recvmmsg call
+ * @sockfd: The file descriptor for the socket
+ * @batch: The batch the datagrams are received in
+ *
+ * Return: int - the number of datagrams received, 0 if none arrived before the timeout
+ **/
+int recvBatch(int *sockfd, struct dgramBatch *batch)
+{
+  for(int i = 0; i < RECV_BATCH; i++) {
+    batch->msgs[i].msg_hdr.msg_namelen = sizeof(batch->addrs[i]);
+    batch->msgs[i].msg_hdr.msg_control = batch->ctrls[i];
+    batch->msgs[i].msg_hdr.msg_controllen = sizeof(batch->ctrls[i]);
+  }
+
+  batch->count = recvmmsg(*sockfd, batch->msgs, RECV_BATCH, MSG_WAITFORONE, NULL);
+  if (batch->count < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) batch->count = 0;
+  if (batch->count < 0) error("ERROR on recvmmsg");
+  return batch->count;
+}
+
+/**
+ * splitBatch - cuts the messages of a received batch into their datagrams. A message the kernel
+ * coalesced (UDP_GRO) holds equal sized datagrams back to back, the last one possibly shorter.
+ * @batch: The received batch
+ * @segs: Set to each datagram, room for RECV_BATCH * GRO_MAX_SEGS
+ *
+ * Return: int - the number of datagrams
+ **/
+int splitBatch(struct dgramBatch *batch, struct rcvdSegment *segs)
+{
+  int numSegs = 0;
+  ssize_t segSize, msgLen, off;
+  struct msghdr *hdr;
+  struct cmsghdr *cmsg;
+  u_char *buf;
+
+  for(int m = 0; m < batch->count; m++) {
+    hdr = &batch->msgs[m].msg_hdr;
+    buf = batch->bufs + m * batch->bufSize;
+    msgLen = batch->msgs[m].msg_len;
+    segSize = msgLen;
+
+    for(cmsg = CMSG_FIRSTHDR(hdr); cmsg != NULL; cmsg = CMSG_NXTHDR(hdr, cmsg))
+      if(cmsg->cmsg_level == SOL_UDP && cmsg->cmsg_type == UDP_GRO) segSize = *(int*) CMSG_DATA(cmsg);
+    if(segSize <= 0 || msgLen > segSize * GRO_MAX_SEGS) segSize = msgLen;
+
+    off = 0;
+    do {
+      segs[numSegs].dgram = buf + off;
+      segs[numSegs].len = (msgLen - off < segSize) ? msgLen - off : segSize;
+      segs[numSegs].addr = &batch->addrs[m];
+      segs[numSegs].impaired = 0;
+      numSegs++;
+      off += segSize;
+    } while(off < msgLen);
+  }
+
+  return numSegs;
+}
+
+/**
+ * flushAcks - sends every queued ACK with as few sendmmsg calls as possible
+ * @sockfd: The file descriptor for the socket
+ * @acks: The queued ACKs
+ **/
+void flushAcks(int *sockfd, struct dgramBatch *acks)
+{
+  int numSent = 0, sent;
+
+  while(numSent < acks->count) {
+    sent = sendmmsg(*sockfd, &acks->msgs[numSent], acks->count - numSent, 0);
+    if(sent < 0) error("Error sending the packet:");
+    numSent += sent;
+  }
+  acks->count = 0;
+}
+
+/**
+ * writerSpace - the payloads a write queue takes before it reaches its high-water mark
+ * @queue: The session's write queue
+ *
+ * Return: uint32_t - the number of payloads, 0 if the client should slow down
+ **/
+uint32_t writerSpace(struct writeQueue *queue)
+{
+  uint64_t used = queue->filled - atomic_load_explicit(&queue->tail, memory_order_relaxed);
+
+  return used < queue->highWater ? queue->highWater - used : 0;
+}
+
+/**
+ * putWord - stores a 32-bit value in network byte order
+ * @buf: Where the value is stored
+ * @value: The value
+ **/
+static inline void putWord(u_char *buf, uint32_t value)
+{
+  buf[0] = value >> 24;
+  buf[1] = value >> 16;
+  buf[2] = value >> 8;
+  buf[3] = value;
+}
+
+/**
+ * makeHeader - makes the ACK datagram to be sent to the client, in the format its handshake agreed
  * @ackDatagram - the datagram to be sent to the client
+ * @sess - the session being ACK'd
  * @seqNum - the sequence number being ACK'd
+ *
+ * Note: a version 1 ACK also carries the busy bit, the receive window (the datagrams past the
+ * cumulative ACK the session can take before its write queue reaches its high-water mark or
+ * its reorder ring is full), the cumulative ACK (the next sequence # in order) and a bitmap of
+ * the SACK_BITS datagrams after it the reorder ring holds. Every ACK is checksummed.
+ *
+ * Return: size_t - the length of the ACK
  **/
-void makeHeader(u_char *ackDatagram, uint32_t seqNum)
+size_t makeHeader(u_char *ackDatagram, struct session *sess, uint32_t seqNum)
 {
+  size_t len = ACK_HDR_LEN;
+  uint16_t flag = ackFlag, calcdChk;
+  uint32_t rwnd, numBits;
+  uint64_t sack = 0;
+  int busy = writerBusy(&sess->writer);
 
-  ackDatagram[0] = seqNum >> 24;
-  ackDatagram[1] = seqNum >> 16;
-  ackDatagram[2] = seqNum >> 8;
-  ackDatagram[3] = seqNum;
+  putWord(ackDatagram, seqNum);
   ackDatagram[4] = pseudoChksum >> 8;
   ackDatagram[5] = pseudoChksum;
-  ackDatagram[6] = ackFlag >> 8;
-  ackDatagram[7] = ackFlag;
+  // Above the high-water mark the ACK also asks the client to slow down
+  if(busy) flag = ackBusyFlag;
 
+  if(sess->ackVersion >= 1) {
+    flag = ackExtFlag;
+    rwnd = writerSpace(&sess->writer);
+    if(sess->mode == MODE_SR) {
+      if(rwnd > sess->reorderWinSize) rwnd = sess->reorderWinSize;
+      numBits = sess->reorderWinSize - 1 < SACK_BITS ? sess->reorderWinSize - 1 : SACK_BITS;
+      for(uint32_t i = 0; i < numBits; i++)
+        if(sess->reorderLens[(sess->reorderHead + 1 + i) % sess->reorderWinSize] > 0) sack |= 1ULL << i;
+    }
+    ackDatagram[8] = 1;     // The version
+    ackDatagram[9] = busy;
+    ackDatagram[10] = 0;
+    ackDatagram[11] = 0;
+    putWord(&ackDatagram[12], rwnd);
+    putWord(&ackDatagram[16], sess->seqExpected);
+    putWord(&ackDatagram[20], sack >> 32);
+    putWord(&ackDatagram[24], sack);
+    len = ACK_EXT_LEN;
+  }
+  ackDatagram[6] = flag >> 8;
+  ackDatagram[7] = flag & 0xFF;
+
+  calcdChk = calcChecksum(ackDatagram, len, 0);
+  ackDatagram[4] = calcdChk >> 8;
+  ackDatagram[5] = calcdChk;
 
 #ifdef DEBUG
-  uint32_t seqSend = (ackDatagram[0] <<  24) | (ackDatagram[1] << 16) | (ackDatagram[2] << 8) | ackDatagram[3];
-  uint16_t chkSend = (ackDatagram[4] << 8) | ackDatagram[5];
-  uint16_t flagSend = (ackDatagram[6] << 8) | ackDatagram[7];  
-  printf("ACK Seq: %u, Chk: %u, Flag: %u\n", seqSend, chkSend, flagSend);
+  printf("ACK Seq: %u, Chk: %u, Flag: %u, Len: %lu\n", seqNum, calcdChk, flag, len);
 #endif
+
+  return len;
 }
 
 /**
- * sendAck - sends an ACK to the client for a datagram received
+ * sendAck - queues an ACK to a session's client for a datagram received. The ACKs for a batch of
+ * received datagrams are sent together by flushAcks()
  * @sockfd: The file descriptor for the socket
- * @server_addr: Contains the info for the server
- * @ackDatagram: The datagram to be sent to the client
+ * @sess: The session being ACK'd, the ACK goes to the address of its last datagram
+ * @acks: The queued ACKs, flushed first if full
  * @seqNum: The sequence number being ACK'd
  **/
-void sendAck(int *sockfd, struct sockaddr_in *server_addr, u_char *ackDatagram, uint32_t seqNum)
+void sendAck(int *sockfd, struct session *sess, struct dgramBatch *acks, uint32_t seqNum)
 {
-  int sendSize;
 
 #ifdef DEBUG
   printf("Sending Ack for sequence # %d: ", seqNum);
 #endif
 
-  makeHeader(ackDatagram, seqNum);
+  if(acks->count == RECV_BATCH) flushAcks(sockfd, acks);
 
-  sendSize = sendto(*sockfd, ackDatagram, ACK_DGRAM_SIZE, 0, (struct sockaddr*) server_addr, sizeof(*server_addr));
-  
-  if(sendSize < 0) error("Error sending the packet:"); 
-  //printf("sendSize: %d\n\n", sendSize);
+  acks->iovs[acks->count].iov_len = makeHeader(acks->bufs + acks->count * acks->bufSize, sess, seqNum);
+  acks->addrs[acks->count] = sess->peer;
+  acks->count++;
+}
+
+/**
+ * sendCtlAck - queues the answer to a probe or a close with the ACKs of the batch
+ * @sockfd: The file descriptor for the socket
+ * @acks: The queued ACKs, flushed first if full
+ * @addr: Where the datagram answered came from
+ * @flag: probeAckFlag or finAckFlag
+ * @seq: The sequence # of the datagram answered, a probe's is its length
+ * @verdict: A FIN ACK's ninth byte, if the hash in the FIN matched (1) or not (0), -1 for an 8 byte ACK
+ **/
+void sendCtlAck(int *sockfd, struct dgramBatch *acks, struct sockaddr_in *addr, uint16_t flag, uint32_t seq, int verdict)
+{
+  u_char *ackDatagram;
+  uint16_t calcdChk;
+
+  if(acks->count == RECV_BATCH) flushAcks(sockfd, acks);
+
+  ackDatagram = acks->bufs + acks->count * acks->bufSize;
+  putWord(ackDatagram, seq);
+  ackDatagram[4] = pseudoChksum >> 8;
+  ackDatagram[5] = pseudoChksum;
+  ackDatagram[6] = flag >> 8;
+  ackDatagram[7] = flag & 0xFF;
+  if(verdict >= 0) ackDatagram[ACK_HDR_LEN] = verdict;
+  calcdChk = calcChecksum(ackDatagram, ACK_HDR_LEN + (verdict >= 0), 0);
+  ackDatagram[4] = calcdChk >> 8;
+  ackDatagram[5] = calcdChk;
+
+  acks->iovs[acks->count].iov_len = ACK_HDR_LEN + (verdict >= 0);
+  acks->addrs[acks->count] = *addr;
+  acks->count++;
 }
 
 /**
  * verifySequence - verifies the sequence number of the datagram received from the client was what it should be
+ * @sess: The session the datagram belongs to
  * @seqRecvd: The sequence number being verified
  **/
-int verifySequence(uint32_t seqRecvd)
+int verifySequence(struct session *sess, uint32_t seqRecvd)
 {
-  if ( seqRecvd == sequenceNumberExpected) {
+  if ( seqRecvd == sess->seqExpected) {
 
 #ifdef DEBUG
     printf("The sequence # was as expected: %d\n", seqRecvd);
 #endif
 
-    sequenceNumberExpected++; 
-    if (sequenceNumberExpected == USHRT_MAX) sequenceNumberExpected = 0;    // refer to global variable declaration
+    sess->seqExpected++;    // Wraps from UINT32_MAX to 0, refer to seqDist()
 
     return 1;
   } else {
 #ifdef DEBUG
-    printf("The sequence # was not as expected: recvd=%d, expect=%d\n", seqRecvd, sequenceNumberExpected);
+    printf("The sequence # was not as expected: recvd=%d, expect=%d\n", seqRecvd, sess->seqExpected);
 #endif
-    return 0;    
+    return 0;
   }
 }
 
@@ -182,14 +1469,14 @@ int verifySequence(uint32_t seqRecvd)
  **/
 int verifyChksum(u_char *recvdDatagram, uint16_t chkRecvd, int dGramSize)
 {
-  uint32_t sum = 0;
   uint16_t calcdChk = 0;
 
-  // Make pseudo header for checksum calculation
-  recvdDatagram[4] = pseudoChksum >> 8;
-  recvdDatagram[5] = pseudoChksum;
+  if (dGramSize < 8) return 0;
 
-  calcdChk = calcChecksum(recvdDatagram, dGramSize, sum);
+  // The pseudo checksum is summed in place of header bytes 4-5 rather than written over them,
+  // the words before and after it are chained onto it
+  calcdChk = calcChecksum(recvdDatagram, 4, pseudoChksum);
+  calcdChk = calcChecksum(recvdDatagram + 6, dGramSize - 6, calcdChk);
 
 #ifdef DEBUG
   printf("Received Chk: %u, Calc'd Chk: %u\n", (unsigned int) chkRecvd, (unsigned int)calcdChk);
@@ -200,116 +1487,396 @@ int verifyChksum(u_char *recvdDatagram, uint16_t chkRecvd, int dGramSize)
     return 1;
   } else {
     printf("Received Chk: %u, Calc'd Chk: %u\n", (unsigned int) chkRecvd, (unsigned int)calcdChk);
-    printf("The checksums did not matched\n");    
+    printf("The checksums did not matched\n");
     return 0;
   }
-}   
+}
 
 /**
- * randZeroToOne - returns a random number between 0 - 1
+ * seqDist - the number of sequence #s from one sequence # to another
+ * @from: The earlier sequence #
+ * @to: The later sequence #
  *
- * Note: rand() must be seeded prior to calls using srand()
+ * Note: sequence #s use the whole 32 bits and wrap from UINT32_MAX to 0 (serial number
+ * arithmetic, RFC 1982)
  *
- * Return: double - the random number generated
+ * Return uint32_t - the distance, wrapping if to is before from
  **/
-double randZeroToOne() {
-  return rand() / (RAND_MAX + 1.);
+uint32_t seqDist(uint32_t from, uint32_t to)
+{
+  return to - from;
 }
 
 /**
- * wasDropped - gets a random number and if it is <= the drop prob it indicates a drop 
- * 	by returning true
- * @drop_prob: the artificial probablity that a packet is dropped
+ * findOption - finds an option in the data of a SYN
+ * @dGram: The SYN received
+ * @dGramLen: The length of the SYN including its header
+ * @type: The option's type
+ * @valueLen: Set to the length of the option's value if it was found
  *
- * Return: int - 1 if the packet should be dropped, 0 otherwise
+ * Return const u_char* - the option's value, NULL if the option wasn't found
  **/
-int wasDropped(double drop_prob) {
-  double randGend = randZeroToOne();
+const u_char *findOption(u_char *dGram, size_t dGramLen, uint8_t type, size_t *valueLen)
+{
+  size_t off = 8;
 
-#ifdef DEBUG
-  printf("randGend: %f, drop_prob: %f\n", randGend, drop_prob);
-#endif
+  while(off + 2 <= dGramLen && off + 2 + dGram[off+1] <= dGramLen) {
+    if(dGram[off] == type) {
+      *valueLen = dGram[off+1];
+      return &dGram[off+2];
+    }
+    off += 2 + dGram[off+1];
+  }
+  return NULL;
+}
+
+/**
+ * getOption - finds a numeric option in the data of a SYN
+ * @dGram: The SYN received
+ * @dGramLen: The length of the SYN including its header
+ * @type: The option's type
+ * @value: Set to the option's value if it was found
+ *
+ * Return int - 1 if the option was found, 0 otherwise
+ **/
+int getOption(u_char *dGram, size_t dGramLen, uint8_t type, uint64_t *value)
+{
+  size_t valueLen;
+  const u_char *optValue = findOption(dGram, dGramLen, type, &valueLen);
 
-  if(randGend <= drop_prob) return 1;
-  return 0;	
-} 
+  if(optValue == NULL || valueLen > 8) return 0;
+  *value = 0;
+  for(size_t i = 0; i < valueLen; i++) *value = (*value << 8) | optValue[i];
+  return 1;
+}
 
-int main(int argc, char *argv[])
+/**
+ * addOption - appends a handshake option to the data of a SYN-ACK
+ * @dGram: The SYN-ACK being built
+ * @off: The offset in the datagram the option is written at
+ * @type: The option's type
+ * @len: The number of bytes in the option's value
+ * @value: The option's value, written in network byte order
+ *
+ * Return size_t - the offset following the option
+ **/
+size_t addOption(u_char *dGram, size_t off, uint8_t type, uint8_t len, uint64_t value)
 {
-  int sockfd, portno;                // The socket file descriptor, port number, and size of rcvdDatagram
-  ssize_t recsize;
-  double drop_prob;                           // Probablity a packet is dropped
-  char *file_name;                            // The file to write to and the buffer to store the datagram
-  u_char recvdDatagram[BUFFER_SIZE] = {0};    // Buffer for receiving datagram
-  u_char ackDatagram[ACK_DGRAM_SIZE] = {0};		// Buffer for ACKs
-  socklen_t clientLen;                        // Stores the size of the clients sockaddr_in 
-  struct sockaddr_in server_addr;             // Sockadder_in structs that store IP address, port, and etc for the server and its client. 
-  uint32_t seqRecvd, chkRecvd, flagRecvd;			// Stores the sequence #, checksum, and flag from the received datagram
-  uint32_t lastACKseq;
+  dGram[off++] = type;
+  dGram[off++] = len;
+  for(int i = len - 1; i >= 0; i--) dGram[off++] = value >> (8*i);
+  return off;
+}
 
-  if (argc < 4) {
-    fprintf(stderr,"usage: %s port# file-name probablity\n", argv[0]);
-    exit(1);
+/**
+ * handleSyn - starts a session with the transfer mode a client asked for in a SYN and answers
+ * with a SYN-ACK. A client that asked for a connection ID is given the session's ID.
+ * @w: The worker the SYN was steered to
+ * @client_addr: Contains the info for the client
+ * @synDatagram: The SYN received
+ * @synLen: The length of the SYN including its header
+ *
+ * Note: A repeated SYN is answered from the session the first one started
+ **/
+void handleSyn(struct worker *w, struct sockaddr_in *client_addr, u_char *synDatagram, ssize_t synLen)
+{
+  u_char synAckDatagram[64] = {0};
+  size_t synAckLen = 8;
+  uint16_t calcdChk;
+  uint32_t synSeq = USHRT_MAX;
+  uint64_t connId;
+  int wantsConnId = getOption(synDatagram, synLen, OPT_CONNID, &connId);
+  struct synRequest req = { MODE_GBN, 0, NULL, 0, 0, 0, 0, 0, CHK_INET16, 0, 0, 0, 0, 0 };
+  struct session *sess;
+  int sockBuf;
+  socklen_t sockBufLen;
+
+  for(sess = w->allSessions; sess != NULL; sess = sess->nextAll)
+    if(samePeer(&sess->peer, client_addr)) break;
+
+  if(sess == NULL) {
+    getOption(synDatagram, synLen, OPT_MODE, &req.mode);
+    getOption(synDatagram, synLen, OPT_WINDOW, &req.window);
+    req.name = findOption(synDatagram, synLen, OPT_NAME, &req.nameLen);
+    getOption(synDatagram, synLen, OPT_JOIN, &req.joinId);
+    getOption(synDatagram, synLen, OPT_OFFSET, &req.offset);
+    getOption(synDatagram, synLen, OPT_ACK_VERSION, &req.ackVersion);
+    getOption(synDatagram, synLen, OPT_MSS, &req.mss);
+    getOption(synDatagram, synLen, OPT_CHECKSUM, &req.chkAlgo);
+    getOption(synDatagram, synLen, OPT_ISN, &req.isn);
+    getOption(synDatagram, synLen, OPT_LENGTH, &req.length);
+    getOption(synDatagram, synLen, OPT_RESUME, &req.resume);
+    getOption(synDatagram, synLen, OPT_HASH, &req.hash);
+    getOption(synDatagram, synLen, OPT_STREAMS, &req.streams);
+    sess = sessionOpen(w, wantsConnId ? 0 : addrKey(client_addr), client_addr, &req);
+    if(sess == NULL) return;
+
+    // Every session of the worker sends its window into the one socket, and windows of large
+    // datagrams overflow the default buffer before the worker drains it. The kernel caps the size
+    // at net.core.rmem_max
+    if(req.window > MAX_REORDER_BYTES / (sess->mss + sess->hdrLen)) req.window = MAX_REORDER_BYTES / (sess->mss + sess->hdrLen);
+    sess->windowBytes = req.window * (sess->mss + sess->hdrLen + DGRAM_OVERHEAD);
+    w->windowBytes += sess->windowBytes;
+    // and doubles the size asked for, leaving room for the retransmissions that follow a loss. The
+    // doubled size is what it reports, so that is what twice the windows are compared with. The
+    // buffer is only ever grown, small windows leave the default alone.
+    if(2 * w->windowBytes > (size_t) w->sockBufSize) {
+      sockBuf = w->windowBytes < INT_MAX ? (int) w->windowBytes : INT_MAX;
+      sockBufLen = sizeof(sockBuf);
+      if(setsockopt(w->sockfd, SOL_SOCKET, SO_RCVBUF, &sockBuf, sizeof(sockBuf)) == 0 &&
+          getsockopt(w->sockfd, SOL_SOCKET, SO_RCVBUF, &sockBuf, &sockBufLen) == 0)
+        w->sockBufSize = sockBuf;
+    }
   }
 
-	//*** Init - Begin ***  
+  synAckDatagram[0] = synSeq >> 24;
+  synAckDatagram[1] = synSeq >> 16;
+  synAckDatagram[2] = synSeq >> 8;
+  synAckDatagram[3] = synSeq;
+  synAckDatagram[6] = synAckFlag >> 8;
+  synAckDatagram[7] = synAckFlag & 0xFF;
+  synAckLen = addOption(synAckDatagram, synAckLen, OPT_MODE, 1, sess->mode);
+  synAckLen = addOption(synAckDatagram, synAckLen, OPT_WINDOW, 4, sess->reorderWinSize);
+  if(sess->hdrLen == CONN_HDR_LEN) synAckLen = addOption(synAckDatagram, synAckLen, OPT_CONNID, 4, sess->id);
+  if(sess->ackVersion > 0) synAckLen = addOption(synAckDatagram, synAckLen, OPT_ACK_VERSION, 1, sess->ackVersion);
+  synAckLen = addOption(synAckDatagram, synAckLen, OPT_MSS, 4, sess->mss);
+  synAckLen = addOption(synAckDatagram, synAckLen, OPT_CHECKSUM, 1, sess->chkAlgo);
+  synAckLen = addOption(synAckDatagram, synAckLen, OPT_ISN, 4, sess->isn);
+  if(sess->writer.ckptFd >= 0) synAckLen = addOption(synAckDatagram, synAckLen, OPT_RESUME, 8, sess->resumeAt);
+  if(sess->writer.hashing) synAckLen = addOption(synAckDatagram, synAckLen, OPT_HASH, 1, HASH_FNV1A64);
 
-  portno = atoi(argv[1]);
-  file_name = argv[2];
-  drop_prob = atof(argv[3]);
+  // The datagrams of the session may be larger than the worker's buffers, which grow once the batch is done
+  if(sess->mss + CONN_HDR_LEN > w->recvBufSize) w->recvBufSize = sess->mss + CONN_HDR_LEN;
+  calcdChk = calcChecksum(synAckDatagram, synAckLen, 0);
+  synAckDatagram[4] = calcdChk >> 8;
+  synAckDatagram[5] = calcdChk;
 
-	srand(time(NULL));		// Sends the RNG
+  if(sendto(w->sockfd, synAckDatagram, synAckLen, 0, (struct sockaddr*) client_addr, sizeof(*client_addr)) < 0)
+    error("Error sending the packet:");
+}
 
-  // Sets all variables in the serv_addr struct to 0 to prevent "junk" 
-  // in the variables. "Always pass structures by reference w/ the 
-  // size of the structure." 
-  //bzero((char *) &server_addr, sizeof(server_addr));
-  memset((char*) &server_addr, 0, sizeof(server_addr));
+/**
+ * bufferSelective - selective repeat: ACKs a datagram individually, holds it in the reorder ring
+ * if it arrived early and writes every datagram now in order to the file
+ * @sockfd: The file descriptor for the socket
+ * @sess: The session the datagram belongs to
+ * @recvdDatagram: The verified datagram received
+ * @recsize: The size of the datagram received
+ * @acks: The queued ACKs
+ * @seqRecvd: The datagram's sequence number
+ *
+ * Note: Datagrams up to a window behind the expected sequence # are re-ACK'd since their
+ * first ACK may have been lost
+ **/
+void bufferSelective(int *sockfd, struct session *sess, u_char *recvdDatagram, ssize_t recsize,
+    struct dgramBatch *acks, uint32_t seqRecvd)
+{
+  uint32_t dist = seqDist(sess->seqExpected, seqRecvd), slot;
+  ssize_t hdrLen = sess->hdrLen;
 
-  server_addr.sin_family = AF_INET;            // Internet Address Family 
-  server_addr.sin_port = htons(portno);        // Port Number in Network Byte Order 
+  if(dist != 0) sess->stats.outOfOrder++;
+  if(dist >= sess->reorderWinSize) {
+    if(seqDist(seqRecvd, sess->seqExpected) <= sess->reorderWinSize) sendAck(sockfd, sess, acks, seqRecvd);
+    return;
+  }
 
-  // IP Address in Network Byte Order. In this case it is always 
-  //   the address on which the server is running. INADDR_ANY gets 
-  //   this address. 
-  server_addr.sin_addr.s_addr = INADDR_ANY;
+  slot = (sess->reorderHead + dist) % sess->reorderWinSize;
+  if(dist == 0) {
+    // In order, written straight from the receive buffer
+    writePayload(&sess->writer, &recvdDatagram[hdrLen], recsize-hdrLen);
+    sess->stats.bytes += recsize-hdrLen;
+    sess->reorderHead = (sess->reorderHead + 1) % sess->reorderWinSize;
+    sess->seqExpected++;
+  } else if(sess->reorderLens[slot] == 0) {
+    memcpy(sess->reorderDgrams[slot], recvdDatagram, recsize);
+    sess->reorderLens[slot] = recsize;
+  }
+  sendAck(sockfd, sess, acks, seqRecvd);
 
-  clientLen = sizeof(server_addr);
+  while(sess->reorderLens[sess->reorderHead] > 0) {
+    writePayload(&sess->writer, &sess->reorderDgrams[sess->reorderHead][hdrLen], sess->reorderLens[sess->reorderHead]-hdrLen);
+    sess->stats.bytes += sess->reorderLens[sess->reorderHead]-hdrLen;
+    sess->reorderLens[sess->reorderHead] = 0;
+    sess->reorderHead = (sess->reorderHead + 1) % sess->reorderWinSize;
+    sess->seqExpected++;
+  }
+}
 
-  // AF_INET is for the IPv4 protocol. SOCK_DGRAM represents a 
-  // Datagram. 0 uses system default for transportation
-  // protocol. In this case will be UDP. 
-  sockfd = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
-  if (sockfd < 0) error("ERROR opening socket");
+/**
+ * receiveData - handles a data datagram of a session, the way its transfer mode does
+ * @sockfd: The file descriptor for the socket
+ * @sess: The session the datagram belongs to
+ * @recvdDatagram: The datagram received
+ * @recsize: The size of the datagram received
+ * @acks: The queued ACKs
+ * @seqRecvd: The datagram's sequence number
+ * @chkRecvd: The datagram's checksum
+ * @from: The address the datagram came from, where the session's ACKs go once it passes its checks
+ **/
+void receiveData(int *sockfd, struct session *sess, u_char *recvdDatagram, ssize_t recsize,
+    struct dgramBatch *acks, uint32_t seqRecvd, uint16_t chkRecvd, const struct sockaddr_in *from)
+{
+  sess->stats.datagrams++;
 
-  // Binds the servers local protocol to the socket. Keeps 
-  // the socket reserved and open for this specific
-  // process. 
-  if ( bind(sockfd, (struct sockaddr *) &server_addr, sizeof(server_addr)) < 0 ) {
-    close(sockfd);
-    error("ERROR on binding the socket");
-  } 
+  if ( recsize < (ssize_t) sess->hdrLen || recsize - sess->hdrLen > sess->mss ||
+      (sess->chkAlgo == CHK_INET16 && !verifyChksum(recvdDatagram, chkRecvd, recsize)) ) {
+    sess->stats.chkFails++;
+    if (sess->mode == MODE_SR) return;
+    sess->numTimesFailed++;
+    if (sess->numTimesFailed >= MAX_TIMES_FAIL) {
+      printf("Attempting to resend ack for %d\n", sess->lastACKseq);
+      sendAck(sockfd, sess, acks, sess->lastACKseq);
+      sess->numTimesFailed = 0;
+    }
+    return;
+  }
 
-  fileToWrite = fopen(argv[2], "w");
-  if(fileToWrite == NULL) error("Error opening the file\n");
+  // A corrupt or spoofed datagram carrying the session's connection ID doesn't move its ACKs
+  sess->peer = *from;
+  if (sess->mode == MODE_SR) {
+    bufferSelective(sockfd, sess, recvdDatagram, recsize, acks, seqRecvd);
+  } else if ( verifySequence(sess, seqRecvd) ) {
+    sendAck(sockfd, sess, acks, seqRecvd);
+    writePayload(&sess->writer, &recvdDatagram[sess->hdrLen], recsize-sess->hdrLen);
+    sess->stats.bytes += recsize-sess->hdrLen;
+    sess->lastACKseq = seqRecvd;
+    sess->numTimesFailed = 0;
+  } else {
+    // Out of order: repeat the last ACK at once so the client can fast retransmit
+    sess->stats.outOfOrder++;
+    sendAck(sockfd, sess, acks, sess->lastACKseq);
+  }
+}
 
-  //*** Init - End ***
+/**
+ * impairSegment - puts a received datagram through the artificial impairment. A duplicate is
+ * added to the end of the batch while there's room, and a corrupted bit is flipped in place.
+ * @w: The worker
+ * @m: The datagram's index in the worker's batch
+ * @numSegs: The number of datagrams in the batch, grown by a duplicate
+ *
+ * Note: Probes and closes without a length, which an older client sends only once, are never
+ *   impaired.
+ *
+ * Return: int - 1 if the datagram is lost, 0 otherwise
+ **/
+int impairSegment(struct worker *w, int m, int *numSegs)
+{
+  struct rcvdSegment *seg = &w->segs[m];
+  uint16_t flag = (seg->dgram[6] << 8) | seg->dgram[7];
+  size_t hdrLen = flag == connCloseFlag ? CONN_HDR_LEN : DATA_HDR_LEN;
+  int verdict;
 
-  //*** The client processes are ready to begin ***
+  if(seg->impaired || flag == probeFlag) return 0;
+  if((flag == closeFlag || flag == connCloseFlag) && seg->len < (ssize_t) hdrLen + 8) return 0;
+
+  verdict = impairDatagram(&w->impair, seg->dgram, seg->len);
+  if((verdict & IMPAIR_DUP) && *numSegs < RECV_BATCH * GRO_MAX_SEGS) {
+    w->segs[*numSegs] = *seg;
+    w->segs[(*numSegs)++].impaired = 1;
+  }
+  return verdict & IMPAIR_DROP;
+}
+
+/**
+ * handleClose - ends a session when its client closes. A close carrying the number of bytes the
+ * client sent ends the session only once every one of them has arrived, and is answered with a
+ * FIN ACK. The client resends it until it gets one. A hash of the range following the length
+ * is checked against the range written, and the FIN ACK says if it matched.
+ * @w: The worker the close was steered to
+ * @sess: The client's session, NULL if it has none
+ * @client_addr: Contains the info for the client
+ * @finDatagram: The close received
+ * @finLen: The length of the close including its header
+ * @seqRecvd: The close's sequence #
+ * @chkRecvd: The close's checksum
+ * @flagRecvd: closeFlag or connCloseFlag
+ * @lost: 1 if the artificial impairment lost the close
+ *
+ * Note: A close whose session already ended is answered again, its FIN ACK was lost. A close
+ *   without a length, from an older client sent only once, ends the session at once and is
+ *   never dropped.
+ **/
+void handleClose(struct worker *w, struct session *sess, struct sockaddr_in *client_addr, u_char *finDatagram,
+    ssize_t finLen, uint32_t seqRecvd, uint16_t chkRecvd, uint16_t flagRecvd, int lost)
+{
+  size_t hdrLen = flagRecvd == connCloseFlag ? CONN_HDR_LEN : DATA_HDR_LEN;
+  uint64_t length = 0;
+  int verdict = -1;
+
+  if(finLen >= (ssize_t) hdrLen + 8) {
+    if(!verifyChksum(finDatagram, chkRecvd, finLen)) return;
+    if(lost) {
+      printf("Packet loss, sequence number = %d\n", seqRecvd);
+      if (sess != NULL) sess->stats.dropped++;
+      return;
+    }
+    for(int i = 0; i < 8; i++) length = (length << 8) | finDatagram[hdrLen + i];
+    if(sess != NULL && sess->stats.bytes != length) return;    // Data is still missing
+    if(sess != NULL && finLen >= (ssize_t) hdrLen + 16) {
+      sess->hashRecvd = 1;
+      for(int i = 0; i < 8; i++) sess->finHash = (sess->finHash << 8) | finDatagram[hdrLen + 8 + i];
+    }
+  }
 
-  int numTimesFailed = 0;
+  // A client with an empty file closes before sending anything, its file is still created
+  if (sess == NULL && flagRecvd == closeFlag && length == 0) sess = addrSession(w, client_addr);
+  if (sess != NULL) {
+    printf("The client has closed the connection\n");
+    sess->finished = 1;
+    verdict = sessionClose(w, sess, "closed");
+  }
+  if (finLen >= (ssize_t) hdrLen + 8) sendCtlAck(&w->sockfd, &w->acks, client_addr, finAckFlag, seqRecvd, verdict);
+}
 
-  while(1)
+/**
+ * workerLoop - a receiver thread: receives the datagrams steered to the worker's socket and
+ * handles them for the worker's sessions until the server is done
+ * @arg: The worker
+ **/
+void *workerLoop(void *arg)
+{
+  struct worker *w = (struct worker*) arg;
+  int numRecvd;
+  ssize_t recsize;
+  u_char *recvdDatagram;                      // The datagram of the batch being processed
+  struct sockaddr_in client_addr;             // The client the datagram came from
+  uint32_t seqRecvd, chkRecvd, flagRecvd;			// Stores the sequence #, checksum, and flag from the received datagram
+  uint32_t connId;
+  int lost;
+  struct session *sess;
+  time_t now, lastReap = nowSec();
+  cpu_set_t cpus;
+
+  // Each worker stays on its own core, so its sessions stay in that core's cache
+  if(numWorkers > 1) {
+    CPU_ZERO(&cpus);
+    CPU_SET(w->index % sysconf(_SC_NPROCESSORS_ONLN), &cpus);
+    pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+  }
+
+  while(keepServing || atomic_load(&sessionsServed) == 0 || atomic_load(&openTransfers) > 0)
   {
-    // Accepts a connection from the client and creates a new socket descriptor
-    // to handle communication between the server and the client. 
-    recsize = recvfrom(sockfd, (void*)recvdDatagram, BUFFER_SIZE, 0, (struct sockaddr*)&server_addr, &clientLen);
-    if (recsize < 0) error("ERROR on recvfrom");
+    // Takes every datagram waiting, up to RECV_BATCH, with one call. Their ACKs are sent
+    // together once the whole batch has been processed.
+    recvBatch(&w->sockfd, &w->recvd);
+    numRecvd = splitBatch(&w->recvd, w->segs);
+    now = nowSec();
+
+    for(int m = 0; m < numRecvd; m++) {
+    recvdDatagram = w->segs[m].dgram;
+    recsize = w->segs[m].len;
+    client_addr = *w->segs[m].addr;
 
 #ifdef DEBUG
     printf("receivesize: %d\n", recsize);
 #endif
 
+    if (recsize < DATA_HDR_LEN) continue;
+
+    // The impairment comes before the header is read, so a flipped bit is met like one from the network
+    lost = impairSegment(w, m, &numRecvd);
+
     //Retrieve header
     seqRecvd = (recvdDatagram[0] <<  24) | (recvdDatagram[1] << 16) | (recvdDatagram[2] << 8) | recvdDatagram[3];
     chkRecvd = (recvdDatagram[4] << 8) | recvdDatagram[5];
@@ -319,33 +1886,223 @@ int main(int argc, char *argv[])
     printf("Seq: %u, Chk: %u, Flag: %u\n", seqRecvd, chkRecvd, flagRecvd);
 #endif
 
-    if (flagRecvd == closeFlag) {
-      printf("The client has closed the connection\n");      
-      break;
+    // Datagrams with a connection ID find their session by it, the rest by their address
+    if (flagRecvd == connDataFlag || flagRecvd == connCloseFlag) {
+      if (recsize < CONN_HDR_LEN) continue;
+      connId = (recvdDatagram[8] <<  24) | (recvdDatagram[9] << 16) | (recvdDatagram[10] << 8) | recvdDatagram[11];
+      sess = findSession(w, connId);
+    } else {
+      sess = findSession(w, addrKey(&client_addr));
     }
 
-    if(!wasDropped(drop_prob)) {
-      if ( verifyChksum(recvdDatagram, chkRecvd, recsize) && verifySequence(seqRecvd) ) {
-  	sendAck(&sockfd, &server_addr, ackDatagram, seqRecvd);      
-        fwrite(&recvdDatagram[8] , sizeof(char), recsize-8, fileToWrite);
-        lastACKseq = seqRecvd;
-        numTimesFailed = 0;
-      } else {
-        numTimesFailed++;
-        if (numTimesFailed >= MAX_TIMES_FAIL) {
-          printf("Attempting to resend ack for %d\n", lastACKseq);
-          sendAck(&sockfd, &server_addr, ackDatagram, lastACKseq);
-          numTimesFailed = 0;
-        }
-      }
-    } else {
+    if (flagRecvd == closeFlag || flagRecvd == connCloseFlag) {
+      handleClose(w, sess, &client_addr, recvdDatagram, recsize, seqRecvd, chkRecvd, flagRecvd, lost);
+      continue;
+    }
+
+    // A probe is answered if it arrived whole, the client takes its size as one the path carries
+    if (flagRecvd == probeFlag) {
+      if (seqRecvd == recsize && verifyChksum(recvdDatagram, chkRecvd, recsize))
+        sendCtlAck(&w->sockfd, &w->acks, &client_addr, probeAckFlag, seqRecvd, -1);
+      continue;
+    }
+
+    if(lost) {
       printf("Packet loss, sequence number = %d\n", seqRecvd);
+      if (sess != NULL) sess->stats.dropped++;
+      continue;
+    }
+
+    if (flagRecvd == synFlag) {
+      if (verifyChksum(recvdDatagram, chkRecvd, recsize)) handleSyn(w, &client_addr, recvdDatagram, recsize);
+      continue;
+    }
+
+    // A client without a connection ID starts its session with the first datagram of its file
+    if (sess == NULL && flagRecvd == dataFlag && seqRecvd == 0 && verifyChksum(recvdDatagram, chkRecvd, recsize))
+      sess = addrSession(w, &client_addr);
+    if (sess == NULL) continue;
+
+    sess->lastHeard = now;
+    receiveData(&w->sockfd, sess, recvdDatagram, recsize, &w->acks, seqRecvd, chkRecvd, &client_addr);
+    }
+
+    // Hands this batch's payloads to the disk writers, the ACKs don't wait for the disk
+    for(sess = w->allSessions; sess != NULL; sess = sess->nextAll) writeFlush(&sess->writer);
+    flushAcks(&w->sockfd, &w->acks);
+
+    if(w->recvBufSize > w->recvd.bufSize) {
+      free(w->recvd.bufs);
+      batchInit(&w->recvd, w->recvBufSize);
     }
 
-    clearBuffers(recvdDatagram, ackDatagram);
+    if(now - lastReap >= 1) {
+      reapSessions(w, now);
+      reapTransfers(now);
+      lastReap = now;
+    }
   }
 
-  close(sockfd);
-  fclose(fileToWrite);  
-  exit(0); 
+  return NULL;
+}
+
+/**
+ * attachSteering - steers every datagram carrying a connection ID to the worker that gave the
+ * ID (ID mod numWorkers), whatever address it comes from. Other datagrams return an index past
+ * the last socket, which leaves them to the kernel's hash of their addresses.
+ * @sockfd: A socket of the port's reuseport group
+ *
+ * Note: the program sees the UDP payload, the datagram's header is at offset 0
+ *
+ * Return: int - 0 on success, -1 if the kernel rejected the program
+ **/
+int attachSteering(int sockfd)
+{
+  struct sock_filter code[] = {
+    BPF_STMT(BPF_LD | BPF_H | BPF_ABS, 6),                      // The flag
+    BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, connDataFlag, 1, 0),
+    BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, connCloseFlag, 0, 3),
+    BPF_STMT(BPF_LD | BPF_W | BPF_ABS, 8),                      // The connection ID
+    BPF_STMT(BPF_ALU | BPF_MOD | BPF_K, numWorkers),
+    BPF_STMT(BPF_RET | BPF_A, 0),
+    BPF_STMT(BPF_RET | BPF_K, 0xFFFFFFFF),
+  };
+  struct sock_fprog prog = { sizeof(code) / sizeof(code[0]), code };
+
+  return setsockopt(sockfd, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &prog, sizeof(prog));
+}
+
+int main(int argc, char *argv[])
+{
+  int portno, groOn, reuse = 1;               // The port number, if the kernel may coalesce datagrams into one message
+  struct sockaddr_in server_addr;             // Sockadder_in struct that stores IP address, port, and etc for the server.
+  struct timeval recvTimeout = { 1, 0 };      // How often idle sessions are looked for when nothing arrives
+  socklen_t sockBufLen;
+  struct worker *w;
+  char *impairSpec = NULL;                    // The -I impairment settings, added to the loss probability
+  int opt;
+
+  highWater = WRITE_QUEUE_SLOTS * HIGH_WATER_PCT / 100;
+  while((opt = getopt(argc, argv, "H:I:kw:")) != -1) {
+    switch(opt) {
+      case 'H': highWater = strtoul(optarg, NULL, 10); break;
+      case 'I': impairSpec = optarg; break;
+      case 'k': keepServing = 1; break;
+      case 'w': numWorkers = atoi(optarg); break;
+      default: argc = 0;
+    }
+  }
+
+  if (argc - optind < 3 || highWater == 0 || highWater > WRITE_QUEUE_SLOTS || numWorkers < 1 || numWorkers > MAX_WORKERS) {
+    fprintf(stderr,"usage: %s [-H high-water] [-I impairment] [-k] [-w workers] port# file-name probablity\n", argv[0]);
+    fprintf(stderr,"  -H: payloads waiting for the disk at which ACKs ask a client to slow down (1-%d, default %d)\n",
+        WRITE_QUEUE_SLOTS, WRITE_QUEUE_SLOTS * HIGH_WATER_PCT / 100);
+    fprintf(stderr,"  -I: impair received datagrams, a list such as seed=42,ge=0.01:0.3,dup=0.001,corrupt=0.0001\n");
+    fprintf(stderr,"      (seed=N, loss=P, ge=P:R[:LOSSGOOD[:LOSSBAD]], dup=P, corrupt=P)\n");
+    fprintf(stderr,"  -k: keep serving after the last session closes\n");
+    fprintf(stderr,"  -w: receiver threads, each pinned to a core with its own socket on the port (1-%d, default 1)\n",
+        MAX_WORKERS);
+    fprintf(stderr,"  file-name: the file each upload is written to, or a directory to write every upload into\n");
+    exit(1);
+  }
+
+	//*** Init - Begin ***
+
+  argv += optind - 1;   // Positional arguments keep their original indices
+
+  portno = atoi(argv[1]);
+  outputName = argv[2];
+
+  // The probability is the loss of the impairment, which the -I settings add to. Delays and
+  // reordering need a queue, impairproxy keeps one.
+  impairDefaults(&impairCfg);
+  impairSetLoss(&impairCfg, atof(argv[3]));
+  if(impairParse(&impairCfg, impairSpec) < 0 || impairTimed(&impairCfg)) {
+    fprintf(stderr, "ERROR: bad impairment: %s (delay, jitter, reorder and rate need impairproxy)\n", impairSpec);
+    exit(1);
+  }
+  printf("Impairment seed: %llu\n", (unsigned long long) impairPickSeed(&impairCfg));
+
+	srand(time(NULL));		// Sends the RNG
+  if(sched_getaffinity(0, sizeof(allCpus), &allCpus) < 0) error("Error getting the CPU affinity");
+
+  // Sets all variables in the serv_addr struct to 0 to prevent "junk"
+  // in the variables. "Always pass structures by reference w/ the
+  // size of the structure."
+  //bzero((char *) &server_addr, sizeof(server_addr));
+  memset((char*) &server_addr, 0, sizeof(server_addr));
+
+  server_addr.sin_family = AF_INET;            // Internet Address Family
+  server_addr.sin_port = htons(portno);        // Port Number in Network Byte Order
+
+  // IP Address in Network Byte Order. In this case it is always
+  //   the address on which the server is running. INADDR_ANY gets
+  //   this address.
+  server_addr.sin_addr.s_addr = INADDR_ANY;
+
+  workers = (struct worker*) calloc(numWorkers, sizeof(*workers));
+  if(workers == NULL) error("Worker memory allocation failure\n");
+
+  // The sockets join the port's reuseport group in worker order, so a socket's index in the
+  // group is its worker's index
+  for(int i = 0; i < numWorkers; i++) {
+    w = &workers[i];
+    w->index = i;
+    impairInit(&w->impair, &impairCfg, i);
+    w->nextIdBase = rand() % ((UINT32_MAX - i) / numWorkers) + 1;
+
+    // AF_INET is for the IPv4 protocol. SOCK_DGRAM represents a
+    // Datagram. 0 uses system default for transportation
+    // protocol. In this case will be UDP.
+    w->sockfd = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    if (w->sockfd < 0) error("ERROR opening socket");
+    if (numWorkers > 1 && setsockopt(w->sockfd, SOL_SOCKET, SO_REUSEPORT, &reuse, sizeof(reuse)) < 0)
+      error("Error setting SO_REUSEPORT");
+
+    // Binds the servers local protocol to the socket. Keeps
+    // the socket reserved and open for this specific
+    // process.
+    if ( bind(w->sockfd, (struct sockaddr *) &server_addr, sizeof(server_addr)) < 0 ) {
+      close(w->sockfd);
+      error("ERROR on binding the socket");
+    }
+
+    // Coalesced datagrams are cut apart again by splitBatch(). Without kernel support each message
+    // holds one datagram.
+    groOn = 1;
+    if(setsockopt(w->sockfd, SOL_UDP, UDP_GRO, &groOn, sizeof(groOn)) < 0) groOn = 0;
+
+    // The receive buffer starts at the kernel's default and is only ever grown from it
+    sockBufLen = sizeof(w->sockBufSize);
+    if(getsockopt(w->sockfd, SOL_SOCKET, SO_RCVBUF, &w->sockBufSize, &sockBufLen) < 0) w->sockBufSize = 0;
+
+    // Wakes up when nothing arrives so idle sessions are still closed
+    if(setsockopt(w->sockfd, SOL_SOCKET, SO_RCVTIMEO, &recvTimeout, sizeof(recvTimeout)) < 0)
+      error("Error setting the socket timeout");
+
+    batchInit(&w->recvd, groOn ? GRO_BUFFER_SIZE : BUFFER_SIZE);
+    w->recvBufSize = w->recvd.bufSize;
+    batchInit(&w->acks, ACK_DGRAM_SIZE);
+  }
+
+  // Without the program a client is still kept on one worker as long as its address doesn't change
+  if(numWorkers > 1 && attachSteering(workers[0].sockfd) < 0)
+    printf("Connection ID steering is not supported, clients are spread by address only\n");
+
+  //*** Init - End ***
+
+  //*** The client processes are ready to begin ***
+
+  for(int i = 1; i < numWorkers; i++)
+    if(pthread_create(&workers[i].thread, NULL, workerLoop, &workers[i]) != 0) error("Error starting a worker thread");
+  workerLoop(&workers[0]);
+  for(int i = 1; i < numWorkers; i++) pthread_join(workers[i].thread, NULL);
+
+  for(int i = 0; i < numWorkers; i++) {
+    close(workers[i].sockfd);
+    free(workers[i].recvd.bufs);
+    free(workers[i].acks.bufs);
+  }
+  free(workers);
+  exit(0);
 }